@@ -0,0 +1,71 @@
+/*
+* MockServer's dialogue played over a memoryTransport, for the microbenchmarks
+* and the fuzz harness.
+*
+* Sends the same option requests and login prompts, then answers every line
+* the session sends with `reply(line)` (by default "<line>\r\n$ "). Telnet
+* commands written by the session are skipped the way MockServer::readLine()
+* skips them.
+*/
+#ifndef RTELNET_MEMORY_DEVICE_H
+#define RTELNET_MEMORY_DEVICE_H
+
+#include "rtelnet_transport.hpp"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace rtnt_bench {
+
+  using lineReply = std::function<std::string(const std::string& line)>;
+
+  inline std::shared_ptr<rtnt::memoryTransport> memoryDevice(lineReply reply = nullptr) {
+    struct dialogue {
+      std::mutex mutex;
+      int step = 0; // 0 username, 1 password, 2 shell
+      int skip = 0; // Bytes left of a telnet command
+      std::string line;
+      lineReply reply;
+    };
+
+    auto state = std::make_shared<dialogue>();
+    state->reply = reply ? std::move(reply) : [](const std::string& line) { return line + "\r\n$ "; };
+
+    auto device = std::make_shared<rtnt::memoryTransport>();
+    device->_onConnect = [state](rtnt::memoryTransport& self) {
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->step = 0;
+        state->skip = 0;
+        state->line.clear();
+      }
+      self.deliver(std::string("\xff\xfd\x18\xff\xfb\x01\xff\xfb\x03", 9)); // DO TERMINAL_TYPE, WILL ECHO, WILL SGA
+      self.deliver("login: ");
+    };
+
+    device->_onWrite = [state](rtnt::memoryTransport& self, std::string_view written) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      for (unsigned char c : written) {
+        if (state->skip > 0) {
+          if (state->skip == 2) state->skip = (c >= 251 && c <= 254) ? 1 : 0;
+          else state->skip = 0;
+          continue;
+        }
+        if (c == 255) { state->skip = 2; continue; }
+        if (c == '\r') continue;
+        if (c != '\n') { state->line.push_back(static_cast<char>(c)); continue; }
+
+        std::string line;
+        line.swap(state->line);
+        if (state->step == 0) { state->step = 1; self.deliver("Password: "); }
+        else if (state->step == 1) { state->step = 2; self.deliver("\r\nWelcome\r\n$ "); }
+        else self.deliver(state->reply(line));
+      }
+    };
+
+    return device;
+  }
+
+}
+#endif // RTELNET_MEMORY_DEVICE_H
@@ -0,0 +1,299 @@
+/*
+* Loopback telnet server used by the benchmarks.
+*
+* Negotiates a few options, asks for a login and a password, then answers every
+* line with "<line>\r\n$ ", except for "dump N" which answers with N bytes of
+* configuration text, "slow <parts> <ms>" which pauses between parts of its reply,
+* "confirm" which waits for an answer to "[confirm]" and lines starting with "bad"
+* which get an IOS style error.
+* With compression on it offers MCCP2 and deflates everything after the login.
+* With awaitAnswers on it waits for an answer to each option request before asking
+* for the login, like most telnetd implementations.
+* limitLogins() makes password checks slow and rejects logins past a number of
+* checks in flight, like a throttling AAA back end.
+*/
+#ifndef RTELNET_MOCK_SERVER_H
+#define RTELNET_MOCK_SERVER_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef RTELNET_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace rtnt_bench {
+
+  class MockServer {
+  public:
+    explicit MockServer(bool compress = false, bool awaitAnswers = false) : _compress(compress), _awaitAnswers(awaitAnswers) {
+      _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+
+      int reuse = 1;
+      setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+      sockaddr_in address{};
+      address.sin_family = AF_INET;
+      address.sin_port = 0;
+      inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+      bind(_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+      listen(_listenFd, 1024);
+
+      socklen_t length = sizeof(address);
+      getsockname(_listenFd, reinterpret_cast<sockaddr*>(&address), &length);
+      _port = ntohs(address.sin_port);
+
+      _acceptor = std::thread([this]() { acceptLoop(); });
+    }
+
+    ~MockServer() {
+      _stop = true;
+      shutdown(_listenFd, SHUT_RDWR);
+      close(_listenFd);
+      if (_acceptor.joinable()) _acceptor.join();
+
+      std::lock_guard<std::mutex> lock(_clientsMutex);
+      for (int fd : _clientFds) shutdown(fd, SHUT_RDWR);
+      for (auto& client : _clients) {
+        if (client.joinable()) client.join();
+      }
+    }
+
+    int port() const { return _port; }
+
+    // Each password check takes `checkMs`, logins arriving while `concurrent` checks
+    // are running fail.
+    void limitLogins(int concurrent, int checkMs) {
+      _loginLimit = concurrent;
+      _loginCheckMs = checkMs;
+    }
+
+    // Deterministic, mildly repetitive text, roughly what a config dump looks like.
+    static std::string payload(size_t size) {
+      std::string text;
+      text.reserve(size + 128);
+      payload(size, size, [&text](const char* data, size_t length) {
+        text.append(data, length);
+        return true;
+      });
+      return text;
+    }
+
+    // Same text handed to `sink` in pieces of about `piece` bytes, never held whole.
+    static bool payload(size_t size, size_t piece, const std::function<bool(const char*, size_t)>& sink) {
+      std::string text;
+      size_t sent = 0;
+      for (size_t n = 0; sent < size; ++n) {
+        text += "interface GigabitEthernet0/" + std::to_string(n) + "\r\n";
+        text += " description uplink-" + std::to_string(n * 7919 % 10007) + "\r\n";
+        text += " ip address 10." + std::to_string(n / 256 % 256) + "." + std::to_string(n % 256) + ".1 255.255.255.0\r\n";
+        text += "!\r\n";
+
+        if (text.size() >= piece || sent + text.size() >= size) {
+          size_t length = std::min(text.size(), size - sent);
+          if (!sink(text.data(), length)) return false;
+          sent += length;
+          text.clear();
+        }
+      }
+      return true;
+    }
+
+  private:
+    bool _compress = false;
+    bool _awaitAnswers = false;
+    int _listenFd = -1;
+    int _port = 0;
+    std::atomic<bool> _stop{false};
+    std::atomic<int> _loginLimit{0};
+    std::atomic<int> _loginCheckMs{0};
+    std::atomic<int> _checking{0};
+    std::thread _acceptor;
+    std::mutex _clientsMutex;
+    std::vector<std::thread> _clients;
+    std::vector<int> _clientFds;
+
+    void acceptLoop() {
+      while (!_stop) {
+        int fd = accept(_listenFd, nullptr, nullptr);
+        if (fd < 0) {
+          if (_stop) return;
+          continue;
+        }
+
+        std::lock_guard<std::mutex> lock(_clientsMutex);
+        _clientFds.push_back(fd);
+        _clients.emplace_back([this, fd]() { serve(fd); close(fd); });
+      }
+    }
+
+    struct connection {
+      int fd;
+#ifdef RTELNET_WITH_ZLIB
+      bool deflating = false;
+      z_stream zstream{};
+#endif
+    };
+
+    static bool sendAll(int fd, const char* data, size_t size) {
+      while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        size -= static_cast<size_t>(sent);
+      }
+      return true;
+    }
+
+    static bool sendAll(int fd, const std::string& data) { return sendAll(fd, data.data(), data.size()); }
+
+    static bool emit(connection& conn, const char* data, size_t size) {
+#ifdef RTELNET_WITH_ZLIB
+      if (conn.deflating) {
+        unsigned char out[16384];
+        conn.zstream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        conn.zstream.avail_in = static_cast<uInt>(size);
+        do {
+          conn.zstream.next_out = out;
+          conn.zstream.avail_out = sizeof(out);
+          deflate(&conn.zstream, Z_SYNC_FLUSH);
+          if (!sendAll(conn.fd, reinterpret_cast<const char*>(out), sizeof(out) - conn.zstream.avail_out)) return false;
+        } while (conn.zstream.avail_out == 0);
+        return true;
+      }
+#endif
+      return sendAll(conn.fd, data, size);
+    }
+
+    static bool emit(connection& conn, const std::string& data) { return emit(conn, data.data(), data.size()); }
+
+    // Reads one line, dropping any telnet command the client sent on the way.
+    static bool readLine(int fd, std::string& line) {
+      line.clear();
+      int skip = 0;
+      unsigned char c;
+
+      while (true) {
+        ssize_t got = recv(fd, &c, 1, 0);
+        if (got <= 0) return false;
+
+        if (skip == 2) { skip = (c >= 251 && c <= 254) ? 1 : 0; continue; } // Option commands carry one more byte
+        if (skip > 0) { --skip; continue; }
+        if (c == 255) { skip = 2; continue; }
+        if (c == '\r') continue;
+        if (c == '\n') return true;
+        line.push_back(static_cast<char>(c));
+      }
+    }
+
+    // Reads `count` IAC <command> <option> answers.
+    static bool readAnswers(int fd, size_t count) {
+      unsigned char answer[3];
+      for (size_t n = 0; n < count; ++n) {
+        size_t got = 0;
+        while (got < sizeof(answer)) {
+          ssize_t read = recv(fd, answer + got, sizeof(answer) - got, 0);
+          if (read <= 0) return false;
+          got += static_cast<size_t>(read);
+        }
+        if (answer[0] != 255) return false;
+      }
+      return true;
+    }
+
+    void serve(int fd) {
+      connection conn{fd};
+      session(conn);
+
+#ifdef RTELNET_WITH_ZLIB
+      if (conn.deflating) deflateEnd(&conn.zstream);
+#endif
+    }
+
+    bool session(connection& conn) {
+      std::vector<unsigned char> negotiation = {
+        255, 253, 24, // DO TERMINAL_TYPE
+        255, 251, 1,  // WILL ECHO
+        255, 251, 3   // WILL SGA
+      };
+      if (_compress) negotiation.insert(negotiation.end(), {255, 251, 86}); // WILL MCCP2
+
+      if (!sendAll(conn.fd, reinterpret_cast<const char*>(negotiation.data()), negotiation.size())) return false;
+      if (_awaitAnswers && !readAnswers(conn.fd, negotiation.size() / 3)) return false;
+      if (!sendAll(conn.fd, "login: ")) return false;
+
+      std::string line;
+      if (!readLine(conn.fd, line)) return false;
+      if (!sendAll(conn.fd, "Password: ")) return false;
+      if (!readLine(conn.fd, line)) return false;
+      if (_loginLimit > 0) {
+        if (_checking.fetch_add(1) >= _loginLimit) {
+          --_checking;
+          sendAll(conn.fd, "\r\n% Authentication failed\r\n");
+          return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(_loginCheckMs));
+        --_checking;
+      }
+      if (!sendAll(conn.fd, "\r\nWelcome\r\n")) return false;
+
+#ifdef RTELNET_WITH_ZLIB
+      if (_compress) {
+        const unsigned char start[] = {255, 250, 86, 255, 240}; // IAC SB MCCP2 IAC SE
+        if (!sendAll(conn.fd, reinterpret_cast<const char*>(start), sizeof(start))) return false;
+        deflateInit(&conn.zstream, Z_DEFAULT_COMPRESSION);
+        conn.deflating = true;
+      }
+#endif
+
+      if (!emit(conn, "$ ")) return false;
+
+      while (!_stop && readLine(conn.fd, line)) {
+        if (line.rfind("dump ", 0) == 0) {
+          // Generated as it is sent, a large dump does not weigh on the client's RSS figures.
+          bool sent = payload(std::stoull(line.substr(5)), 64 * 1024, [&conn](const char* data, size_t length) {
+            return emit(conn, data, length);
+          });
+          if (!sent || !emit(conn, "\r\n$ ")) return false;
+        } else if (line.rfind("slow ", 0) == 0) {
+          // "slow <parts> <ms>": a device that pauses between parts of its reply.
+          int parts = 0, pause = 0;
+          std::sscanf(line.c_str(), "slow %d %d", &parts, &pause);
+          if (!emit(conn, line + "\r\n")) return false;
+          for (int part = 0; part < parts; ++part) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(pause));
+            if (!emit(conn, "part " + std::to_string(part) + "\r\n")) return false;
+          }
+          if (!emit(conn, "$ ")) return false;
+        } else if (line.rfind("confirm", 0) == 0) {
+          // A command that stops on a confirmation, like reload or copy.
+          if (!emit(conn, line + "\r\nProceed? [confirm]")) return false;
+          std::string answer;
+          if (!readLine(conn.fd, answer)) return false;
+          if (!emit(conn, answer + "\r\nDone.\r\n$ ")) return false;
+        } else if (line.rfind("bad", 0) == 0) {
+          if (!emit(conn, line + "\r\n% Invalid input detected at '^' marker.\r\n$ ")) return false;
+        } else {
+          if (!emit(conn, line + "\r\n$ ")) return false;
+        }
+      }
+
+      return true;
+    }
+  };
+
+}
+#endif // RTELNET_MOCK_SERVER_H
@@ -0,0 +1,805 @@
+/*
+* Relic Telnet benchmarks, run against the loopback mock server.
+*
+* Usage: relic-telnet-bench [suite] [sessions] [bytes]
+* (the push suite reads [sessions] as the number of lines, the gateway, adaptive,
+* handshake and respond suites as the number of calls, the admission suite as the number
+* of sessions, the spill suite as the dump size in MB, the template suite only uses [bytes])
+*/
+#include "rtelnet.hpp"
+#include "rtelnet_gateway.hpp"
+#include "mock_server.hpp"
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <sstream>
+
+using namespace rtnt;
+using namespace rtnt_bench;
+using Clock = std::chrono::steady_clock;
+
+struct BenchConfig {
+  int sessions = 0;        // 0 = suite default
+  size_t bytes = 8 << 20;  // per session
+};
+
+static void printRow(const std::string& name, int sessions, size_t bytes, double seconds) {
+  double megabytes = static_cast<double>(bytes) * sessions / (1024.0 * 1024.0);
+  std::cout << std::left << std::setw(28) << name
+            << std::right << std::setw(10) << sessions
+            << std::setw(12) << std::fixed << std::setprecision(1) << megabytes
+            << std::setw(12) << std::setprecision(1) << seconds * 1000.0
+            << std::setw(12) << std::setprecision(1) << megabytes / seconds << "\n";
+}
+
+static void printHeader() {
+  std::cout << std::left << std::setw(28) << "case"
+            << std::right << std::setw(10) << "sessions"
+            << std::setw(12) << "MB"
+            << std::setw(12) << "ms"
+            << std::setw(12) << "MB/s" << "\n";
+}
+
+// Drops whatever is left in the shared buffer after Login() (the banner and prompt).
+static void drain(session& s) {
+  std::vector<unsigned char> out;
+  do {
+    out.clear();
+    s.Read(out, 1 << 20, 0, 100);
+  } while (!out.empty());
+}
+
+// Streams `bytes` from the mock server on every session in parallel, returns wall seconds or -1.
+static double streamDump(int port, TransportBackend backend, int sessions, size_t bytes,
+                         const std::function<void(session&)>& configure = nullptr,
+                         std::vector<std::unique_ptr<session>>* keep = nullptr) {
+  std::vector<std::unique_ptr<session>> pool;
+  for (int i = 0; i < sessions; ++i) {
+    pool.emplace_back(std::make_unique<session>("127.0.0.1", "bench", "bench", port));
+    pool.back()->_backend = backend;
+    if (configure) configure(*pool.back());
+  }
+
+  std::atomic<int> failures{0};
+  std::vector<std::thread> workers;
+  for (auto& s : pool) {
+    workers.emplace_back([&s, &failures]() {
+      if (s->Connect() != RTELNET_SUCCESS) { ++failures; return; }
+      drain(*s);
+    });
+  }
+  for (auto& worker : workers) worker.join();
+  workers.clear();
+  if (failures > 0) return -1;
+
+  auto start = Clock::now();
+  for (auto& s : pool) {
+    workers.emplace_back([&s, &failures, bytes]() {
+      if (s->_tcp.Send("dump " + std::to_string(bytes) + "\n") != RTELNET_SUCCESS) { ++failures; return; }
+
+      size_t received = 0;
+      std::vector<unsigned char> out;
+      while (received < bytes) {
+        out.clear();
+        s->Read(out, 1 << 20, 0, 5000);
+        if (out.empty()) { ++failures; return; }
+        received += out.size();
+      }
+    });
+  }
+  for (auto& worker : workers) worker.join();
+  auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  if (keep) *keep = std::move(pool);
+  return (failures > 0) ? -1 : seconds;
+}
+
+// select vs epoll vs io_uring receive paths.
+static void benchTransport(const BenchConfig& config) {
+  MockServer server;
+  std::vector<int> sessionCounts = config.sessions ? std::vector<int>{config.sessions} : std::vector<int>{1, 16};
+
+  const std::vector<std::pair<std::string, TransportBackend>> backends = {
+    {"select", TransportBackend::SELECT},
+    {"epoll", TransportBackend::EPOLL},
+    {"io_uring", TransportBackend::IO_URING},
+  };
+
+  printHeader();
+  for (const auto& [name, backend] : backends) {
+#ifndef RTELNET_WITH_IO_URING
+    if (backend == TransportBackend::IO_URING) {
+      std::cout << std::left << std::setw(28) << name << "   skipped (built without RTELNET_IO_URING)\n";
+      continue;
+    }
+#endif
+    for (int sessions : sessionCounts) {
+      double seconds = streamDump(server.port(), backend, sessions, config.bytes);
+      if (seconds < 0) {
+        std::cout << std::left << std::setw(28) << name << "   failed\n";
+        continue;
+      }
+      printRow(name, sessions, config.bytes, seconds);
+    }
+  }
+}
+
+// Round trips of a small command, returns the median in microseconds or -1.
+static double pingPong(session& s, int rounds) {
+  std::vector<double> samples;
+  std::vector<unsigned char> out;
+
+  for (int i = 0; i < rounds; ++i) {
+    auto start = Clock::now();
+    if (s._tcp.Send("ping\n") != RTELNET_SUCCESS) return -1;
+
+    std::string reply;
+    while (reply.size() < 2 || reply.compare(reply.size() - 2, 2, "$ ") != 0) {
+      out.clear();
+      s.Read(out, 1 << 20, 0, 5000);
+      if (out.empty()) return -1;
+      reply.append(out.begin(), out.end());
+    }
+    samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+  }
+
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+// Like pingPong() with `burst` commands written one by one before the replies are
+// read, the pattern of a windowed Push() where Nagle holds back the small writes.
+static double pingBurst(session& s, int rounds, int burst) {
+  std::vector<double> samples;
+  std::vector<unsigned char> out;
+
+  for (int i = 0; i < rounds; ++i) {
+    auto start = Clock::now();
+    for (int n = 0; n < burst; ++n) {
+      if (s._tcp.Send("ping\n") != RTELNET_SUCCESS) return -1;
+    }
+
+    int prompts = 0;
+    std::string reply;
+    while (prompts < burst) {
+      out.clear();
+      s.Read(out, 1 << 20, 0, 5000);
+      if (out.empty()) return -1;
+      reply.append(out.begin(), out.end());
+      for (size_t at = reply.find("$ "); at != std::string::npos; at = reply.find("$ ")) {
+        ++prompts;
+        reply.erase(0, at + 2);
+      }
+    }
+    samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+  }
+
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+// Default vs low latency vs throughput socket profiles.
+static void benchProfiles(const BenchConfig& config) {
+  MockServer server;
+  int sessions = config.sessions ? config.sessions : 4;
+
+  const std::vector<std::pair<std::string, transportOptions>> profiles = {
+    {"default", transportOptions{}},
+    {"lowLatency", transportOptions::lowLatency()},
+    {"throughput", transportOptions::throughput()},
+  };
+
+  std::cout << std::left << std::setw(28) << "profile"
+            << std::right << std::setw(14) << "rtt p50 us"
+            << std::setw(16) << "burst8 p50 us"
+            << std::setw(14) << "dump MB/s" << "\n";
+
+  for (const auto& [name, options] : profiles) {
+    session s("127.0.0.1", "bench", "bench", server.port());
+    s._transport = options;
+    double rtt = -1, burst = -1;
+    if (s.Connect() == RTELNET_SUCCESS) {
+      drain(s);
+      rtt = pingPong(s, 200);
+      burst = pingBurst(s, 200, 8);
+    }
+
+    auto configure = [&options](session& target) { target._transport = options; };
+    double seconds = streamDump(server.port(), TransportBackend::SELECT, sessions, config.bytes, configure);
+    double megabytes = static_cast<double>(config.bytes) * sessions / (1024.0 * 1024.0);
+
+    std::cout << std::left << std::setw(28) << name
+              << std::right << std::setw(14) << std::fixed << std::setprecision(1) << rtt
+              << std::setw(16) << burst
+              << std::setw(14) << (seconds > 0 ? megabytes / seconds : -1) << "\n";
+  }
+}
+
+// Same dump with and without MCCP2, wire bytes vs delivered bytes.
+static void benchMCCP2(const BenchConfig& config) {
+#ifndef RTELNET_WITH_ZLIB
+  (void)config;
+  std::cout << "skipped (built without RTELNET_MCCP2)\n";
+#else
+  int sessions = config.sessions ? config.sessions : 1;
+
+  std::cout << std::left << std::setw(28) << "case"
+            << std::right << std::setw(14) << "wire bytes"
+            << std::setw(16) << "delivered"
+            << std::setw(10) << "ratio"
+            << std::setw(12) << "ms" << "\n";
+
+  for (bool compress : {false, true}) {
+    MockServer server(compress);
+    std::vector<std::unique_ptr<session>> pool;
+    double seconds = streamDump(server.port(), TransportBackend::SELECT, sessions, config.bytes, nullptr, &pool);
+    if (seconds < 0) {
+      std::cout << std::left << std::setw(28) << (compress ? "mccp2" : "plain") << "   failed\n";
+      continue;
+    }
+
+    uint64_t wire = 0, delivered = 0;
+    for (auto& s : pool) {
+      wire += s->getMetrics().bytesOnWire;
+      delivered += s->getMetrics().bytesDelivered;
+    }
+
+    std::cout << std::left << std::setw(28) << (compress ? "mccp2" : "plain")
+              << std::right << std::setw(14) << wire
+              << std::setw(16) << delivered
+              << std::setw(10) << std::fixed << std::setprecision(2) << static_cast<double>(delivered) / wire
+              << std::setw(12) << std::setprecision(1) << seconds * 1000.0 << "\n";
+  }
+#endif
+}
+
+// Config push: one Execute() per line vs Push() with growing windows.
+static void benchPush(const BenchConfig& config) {
+  MockServer server;
+  size_t count = config.sessions ? static_cast<size_t>(config.sessions) : 200;
+
+  std::vector<std::string> lines;
+  for (size_t n = 0; n < count; ++n) lines.push_back(" description uplink-" + std::to_string(n));
+
+  std::cout << std::left << std::setw(28) << "case"
+            << std::right << std::setw(10) << "lines"
+            << std::setw(12) << "ms"
+            << std::setw(14) << "lines/s" << "\n";
+
+  auto printPush = [](const std::string& name, size_t done, double seconds) {
+    std::cout << std::left << std::setw(28) << name
+              << std::right << std::setw(10) << done
+              << std::setw(12) << std::fixed << std::setprecision(1) << seconds * 1000.0
+              << std::setw(14) << std::setprecision(0) << done / seconds << "\n";
+  };
+
+  {
+    session s("127.0.0.1", "bench", "bench", server.port());
+    s._idle = 20;
+    if (s.Connect() != RTELNET_SUCCESS) return;
+    drain(s);
+
+    // One idle period per line, capped so large pushes finish in reasonable time.
+    size_t executed = std::min<size_t>(lines.size(), 200);
+    auto start = Clock::now();
+    std::string output;
+    for (size_t n = 0; n < executed; ++n) s.Execute(lines[n], output);
+    printPush("execute (idle 20ms)", executed, std::chrono::duration<double>(Clock::now() - start).count());
+  }
+
+  // Prompt acknowledged, then echo acknowledged (which waits one idle period for the last line's output).
+  // Low latency profile: with several lines in flight, delayed ACKs would otherwise stall the replies.
+  const std::vector<std::pair<std::string, size_t>> cases = {
+    {"$ ", 1}, {"$ ", 8}, {"$ ", 32}, {"", 8},
+  };
+
+  for (const auto& [prompt, window] : cases) {
+    session s("127.0.0.1", "bench", "bench", server.port());
+    s._idle = 20;
+    s._transport = transportOptions::lowLatency();
+    if (s.Connect() != RTELNET_SUCCESS) return;
+    drain(s);
+
+    pushOptions options;
+    options.prompt = prompt;
+    options.window = window;
+    options.windowBytes = 4096;
+    pushReport report;
+
+    auto start = Clock::now();
+    s.Push(lines, report, options);
+    std::string name = std::string(prompt.empty() ? "push echo" : "push prompt") + " window " + std::to_string(window);
+    printPush(name, report.acknowledged, std::chrono::duration<double>(Clock::now() - start).count());
+  }
+}
+
+// Short lived callers: log in per call vs going through relic-telnetd.
+static void benchGateway(const BenchConfig& config) {
+  MockServer server;
+  int calls = config.sessions ? config.sessions : 50;
+  const int idle = 20;
+
+  std::string path = "/tmp/relic-telnetd-bench-" + std::to_string(getpid()) + ".sock";
+  gatewayServer gateway(path, idle);
+  if (gateway.Listen() != RTELNET_SUCCESS) {
+    std::cout << "failed to listen on " << path << "\n";
+    return;
+  }
+
+  gatewayTarget target{"127.0.0.1", server.port(), "bench", "bench"};
+
+  std::cout << std::left << std::setw(32) << "case"
+            << std::right << std::setw(8) << "calls"
+            << std::setw(12) << "p50 ms"
+            << std::setw(12) << "p99 ms"
+            << std::setw(12) << "MB/s" << "\n";
+
+  auto printCalls = [](const std::string& name, std::vector<double>& samples) {
+    std::sort(samples.begin(), samples.end());
+    std::cout << std::left << std::setw(32) << name
+              << std::right << std::setw(8) << samples.size()
+              << std::setw(12) << std::fixed << std::setprecision(2) << samples[samples.size() / 2]
+              << std::setw(12) << samples[samples.size() * 99 / 100]
+              << std::setw(12) << "-" << "\n";
+  };
+
+  auto printStream = [](const std::string& name, double megabytesPerSecond) {
+    std::cout << std::left << std::setw(32) << name
+              << std::right << std::setw(8) << 1
+              << std::setw(12) << "-"
+              << std::setw(12) << "-"
+              << std::setw(12) << std::fixed << std::setprecision(1) << megabytesPerSecond << "\n";
+  };
+
+  auto timed = [calls](const std::function<void()>& call) {
+    std::vector<double> samples;
+    for (int i = 0; i < calls; ++i) {
+      auto start = Clock::now();
+      call();
+      samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    return samples;
+  };
+
+  std::string output;
+
+  std::vector<double> samples = timed([&]() {
+    session s("127.0.0.1", "bench", "bench", server.port());
+    s._idle = idle;
+    if (s.Connect() == RTELNET_SUCCESS) s.Execute("show clock", output);
+  });
+  printCalls("direct, login per call", samples);
+
+  session persistent("127.0.0.1", "bench", "bench", server.port());
+  persistent._idle = idle;
+  if (persistent.Connect() != RTELNET_SUCCESS) return;
+  persistent.FlushBanner();
+  samples = timed([&]() { persistent.Execute("show clock", output); });
+  printCalls("direct, persistent session", samples);
+
+  samples = timed([&]() {
+    gatewayClient client(path);
+    client.Execute(target, "show clock", output);
+  });
+  printCalls("gateway, new client per call", samples);
+
+  // Bulk output, streamed chunk by chunk. Generating the dump takes longer than the
+  // short idle above, so these use the default idle and are timed to the last chunk.
+  gatewayServer bulk(path + ".bulk");
+  if (bulk.Listen() != RTELNET_SUCCESS) return;
+  persistent._idle = RTELNET_IDLE_TIMEOUT;
+
+  size_t received = 0;
+  auto start = Clock::now();
+  auto last = start;
+  persistent.Stream("dump " + std::to_string(config.bytes), [&](const char*, size_t size) {
+    received += size;
+    last = Clock::now();
+    return 0;
+  });
+  double direct = received / (1024.0 * 1024.0) / std::chrono::duration<double>(last - start).count();
+
+  gatewayClient client(path + ".bulk");
+  client.Execute(target, "warm up", output); // Logs the pooled session in
+  received = 0;
+  start = Clock::now();
+  client.Stream(target, "dump " + std::to_string(config.bytes), [&](std::string_view chunk) {
+    received += chunk.size();
+    last = Clock::now();
+  });
+  double gatewayed = received / (1024.0 * 1024.0) / std::chrono::duration<double>(last - start).count();
+
+  printStream("direct, stream dump", direct);
+  printStream("gateway, stream dump", gatewayed);
+}
+
+// Fixed vs learned idle timeout, on a device that answers at once and on one that pauses.
+static void benchAdaptive(const BenchConfig& config) {
+  MockServer fastDevice;
+  MockServer slowDevice;
+  int commands = config.sessions ? config.sessions : 40;
+
+  std::string path = "/tmp/relic-telnet-bench-" + std::to_string(getpid()) + ".idle";
+  adaptiveIdleOptions options;
+  options.minSamples = 16;
+
+  std::cout << std::left << std::setw(32) << "case"
+            << std::right << std::setw(10) << "commands"
+            << std::setw(14) << "ms/command"
+            << std::setw(12) << "truncated"
+            << std::setw(12) << "cutoff ms" << "\n";
+
+  auto run = [commands](const std::string& name, int port, const std::string& command, const std::string& last,
+                        int idle, const std::shared_ptr<idleProfiles>& profiles) {
+    session s("127.0.0.1", "bench", "bench", port);
+    s._idle = idle;
+    s._idleProfiles = profiles;
+    s._transport.noDelay = true;
+    s._transport.quickAck = true;
+    if (s.Connect() != RTELNET_SUCCESS) return;
+    s.FlushBanner();
+
+    // Truncated: the reply misses its end, or starts with the tail of the previous one.
+    int truncated = 0;
+    std::string output;
+    auto start = Clock::now();
+    for (int i = 0; i < commands; ++i) {
+      s.Execute(command, output);
+      if (output.rfind(command, 0) != 0 || output.find(last) == std::string::npos) ++truncated;
+    }
+    double perCommand = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / commands;
+
+    std::cout << std::left << std::setw(32) << name
+              << std::right << std::setw(10) << commands
+              << std::setw(14) << std::fixed << std::setprecision(1) << perCommand
+              << std::setw(12) << truncated
+              << std::setw(12) << s.getMetrics().idleCutoff << "\n";
+  };
+
+  std::remove(path.c_str());
+  run("fast, fixed 200ms", fastDevice.port(), "show clock", "$ ", 200, nullptr);
+  run("slow, fixed 100ms", slowDevice.port(), "slow 3 120", "part 2", 100, nullptr);
+
+  {
+    auto profiles = std::make_shared<idleProfiles>(path, options);
+    run("fast, adaptive (cold)", fastDevice.port(), "show clock", "$ ", 200, profiles);
+    run("slow, adaptive (cold)", slowDevice.port(), "slow 3 120", "part 2", 100, profiles);
+  }
+
+  // A later run picks up where the last one stopped.
+  {
+    auto profiles = std::make_shared<idleProfiles>(path, options);
+    run("fast, adaptive (from file)", fastDevice.port(), "show clock", "$ ", 200, profiles);
+    run("slow, adaptive (from file)", slowDevice.port(), "slow 3 120", "part 2", 100, profiles);
+  }
+  std::remove(path.c_str());
+}
+
+// Connect() to logged in, with and without the host's negotiation profile.
+static void benchHandshake(const BenchConfig& config) {
+  MockServer eager;                // Asks for the login right after its option requests
+  MockServer waiting(false, true); // Waits for our answers first
+  int connects = config.sessions ? config.sessions : 50;
+
+  std::cout << std::left << std::setw(32) << "case"
+            << std::right << std::setw(10) << "connects"
+            << std::setw(12) << "p50 ms"
+            << std::setw(12) << "p99 ms"
+            << std::setw(12) << "early" << "\n";
+
+  auto run = [connects](const std::string& name, int port, const std::shared_ptr<negotiationProfiles>& profiles) {
+    std::vector<double> samples;
+    uint64_t early = 0;
+    for (int i = 0; i < connects; ++i) {
+      session s("127.0.0.1", "bench", "bench", port);
+      s._negotiationProfiles = profiles;
+
+      auto start = Clock::now();
+      if (s.Connect() != RTELNET_SUCCESS) {
+        std::cout << std::left << std::setw(32) << name << "   failed\n";
+        return;
+      }
+      samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+      early += s.getMetrics().earlyAnswers;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    std::cout << std::left << std::setw(32) << name
+              << std::right << std::setw(10) << connects
+              << std::setw(12) << std::fixed << std::setprecision(2) << samples[samples.size() / 2]
+              << std::setw(12) << samples[samples.size() * 99 / 100]
+              << std::setw(12) << std::setprecision(1) << static_cast<double>(early) / connects << "\n";
+  };
+
+  run("eager server, cold", eager.port(), nullptr);
+  run("eager server, profile", eager.port(), std::make_shared<negotiationProfiles>());
+  run("waiting server, cold", waiting.port(), nullptr);
+  run("waiting server, profile", waiting.port(), std::make_shared<negotiationProfiles>());
+}
+
+// A command stopping on "[confirm]": answered by the caller in a second round, or
+// by an auto responder rule from the reader.
+static void benchRespond(const BenchConfig& config) {
+  MockServer device;
+  int calls = config.sessions ? config.sessions : 20;
+
+  std::cout << std::left << std::setw(32) << "case"
+            << std::right << std::setw(10) << "calls"
+            << std::setw(12) << "ms/call"
+            << std::setw(12) << "complete"
+            << std::setw(12) << "answers" << "\n";
+
+  auto run = [calls, &device](const std::string& name, bool autoRespond,
+                              const std::function<void(session&, std::string&)>& call) {
+    session s("127.0.0.1", "bench", "bench", device.port());
+    s._idle = 200;
+    if (autoRespond) s.AutoRespond("[confirm]", "\n", 0);
+    if (s.Connect() != RTELNET_SUCCESS) return;
+    s.FlushBanner();
+
+    int complete = 0;
+    std::string output;
+    auto start = Clock::now();
+    for (int i = 0; i < calls; ++i) {
+      output.clear();
+      call(s, output);
+      if (output.find("Done.") != std::string::npos) ++complete;
+    }
+    double perCall = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / calls;
+
+    std::cout << std::left << std::setw(32) << name
+              << std::right << std::setw(10) << calls
+              << std::setw(12) << std::fixed << std::setprecision(2) << perCall
+              << std::setw(12) << complete
+              << std::setw(12) << s.getMetrics().autoResponses << "\n";
+  };
+
+  run("Execute, caller answers", false, [](session& s, std::string& output) {
+    std::string answer;
+    s.Execute("confirm", output);
+    s.Execute("", answer);
+    output += answer;
+  });
+  run("Expect, caller answers", false, [](session& s, std::string& output) {
+    std::string answer;
+    s.Expect("confirm", "[confirm]", output);
+    s.Expect("", "$ ", answer);
+    output += answer;
+  });
+  run("Execute, auto responder", true, [](session& s, std::string& output) { s.Execute("confirm", output); });
+  run("Expect, auto responder", true, [](session& s, std::string& output) { s.Expect("confirm", "$ ", output); });
+}
+
+// A burst of connects to a device whose AAA rejects logins past 8 checks in flight,
+// with and without an admission controller in front.
+static void benchAdmission(const BenchConfig& config) {
+  MockServer device;
+  device.limitLogins(8, 20);
+  int sessions = config.sessions ? config.sessions : 64;
+
+  std::cout << std::left << std::setw(32) << "case"
+            << std::right << std::setw(10) << "sessions"
+            << std::setw(8) << "ok"
+            << std::setw(10) << "wall ms"
+            << std::setw(12) << "wait p50"
+            << std::setw(12) << "wait p99" << "\n";
+
+  auto run = [sessions, &device](const std::string& name, const std::shared_ptr<admissionController>& admission) {
+    std::atomic<int> ok{0};
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for (int i = 0; i < sessions; ++i) {
+      workers.emplace_back([&]() {
+        session s("127.0.0.1", "bench", "bench", device.port());
+        s._admission = admission;
+        if (s.Connect() == RTELNET_SUCCESS) ++ok;
+      });
+    }
+    for (auto& worker : workers) worker.join();
+    double wall = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    admissionStats stats = admission ? admission->stats() : admissionStats();
+    std::cout << std::left << std::setw(32) << name
+              << std::right << std::setw(10) << sessions
+              << std::setw(8) << ok.load()
+              << std::setw(10) << std::fixed << std::setprecision(0) << wall
+              << std::setw(12) << std::setprecision(1) << stats.waitP50
+              << std::setw(12) << stats.waitP99 << "\n";
+  };
+
+  admissionOptions perHost;
+  perHost.maxPerHost = 8;
+  admissionOptions paced;
+  paced.hostConnectRate = 200;
+  paced.hostConnectBurst = 4;
+
+  run("no admission", nullptr);
+  run("8 sessions per host", std::make_shared<admissionController>(perHost));
+  run("200 connects/s, burst 4", std::make_shared<admissionController>(paced));
+}
+
+// Interfaces out of a config dump: compiled template vs std::regex tried line by line.
+static void benchTemplate(const BenchConfig& config) {
+  const std::string text = MockServer::payload(config.bytes);
+  const double megabytes = text.size() / (1024.0 * 1024.0);
+
+  textTemplate interfaces;
+  std::string error;
+  if (!interfaces.compile(R"(Value Required Interface (\S+)
+Value Description (.*)
+Value Address (\d+\.\d+\.\d+\.\d+)
+Value Mask (\d+\.\d+\.\d+\.\d+)
+
+Start
+  ^interface ${Interface}
+  ^ description ${Description}
+  ^ ip address ${Address} ${Mask}
+  ^! -> Record
+)", error)) {
+    std::cout << "template: " << error << "\n";
+    return;
+  }
+
+  std::cout << std::left << std::setw(32) << "case"
+            << std::right << std::setw(10) << "MB"
+            << std::setw(12) << "ms"
+            << std::setw(12) << "MB/s"
+            << std::setw(12) << "rows" << "\n";
+
+  auto printParse = [megabytes](const std::string& name, double seconds, size_t rows) {
+    std::cout << std::left << std::setw(32) << name
+              << std::right << std::setw(10) << std::fixed << std::setprecision(1) << megabytes
+              << std::setw(12) << seconds * 1000.0
+              << std::setw(12) << megabytes / seconds
+              << std::setw(12) << rows << "\n";
+  };
+
+  // What collectors hand write today: every regex tried on every line until one matches.
+  {
+    const std::regex interfaceLine(R"(^interface (\S+))");
+    const std::regex descriptionLine(R"(^ description (.*))");
+    const std::regex addressLine(R"(^ ip address (\d+\.\d+\.\d+\.\d+) (\d+\.\d+\.\d+\.\d+))");
+    const std::regex endLine(R"(^!)");
+
+    auto start = Clock::now();
+    std::vector<std::array<std::string, 4>> rows;
+    std::array<std::string, 4> current;
+    std::istringstream lines(text);
+    std::smatch match;
+    for (std::string line; std::getline(lines, line);) {
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (std::regex_search(line, match, interfaceLine)) current[0] = match[1];
+      else if (std::regex_search(line, match, descriptionLine)) current[1] = match[1];
+      else if (std::regex_search(line, match, addressLine)) { current[2] = match[1]; current[3] = match[2]; }
+      else if (std::regex_search(line, match, endLine)) {
+        if (!current[0].empty()) rows.push_back(current);
+        current = {};
+      }
+    }
+    if (!current[0].empty()) rows.push_back(current);
+    printParse("std::regex per line", std::chrono::duration<double>(Clock::now() - start).count(), rows.size());
+  }
+
+  {
+    auto start = Clock::now();
+    templateResult result;
+    interfaces.parse(text, result);
+    printParse("template, whole output", std::chrono::duration<double>(Clock::now() - start).count(), result.rows.size());
+  }
+
+  {
+    auto start = Clock::now();
+    templateParser parser(interfaces);
+    for (size_t offset = 0; offset < text.size(); offset += 64 * 1024) {
+      parser.feed(std::string_view(text).substr(offset, 64 * 1024));
+    }
+    parser.finish();
+    printParse("template, 64 KB chunks", std::chrono::duration<double>(Clock::now() - start).count(), parser.result().rows.size());
+  }
+
+  // Parsed while the dump streams in from the mock server.
+  MockServer server;
+  session s("127.0.0.1", "bench", "bench", server.port());
+  s._idle = 200;
+  if (s.Connect() != RTELNET_SUCCESS) return;
+  s.FlushBanner();
+
+  templateResult result;
+  auto start = Clock::now();
+  s.Execute("dump " + std::to_string(config.bytes), interfaces, result);
+  printParse("session Execute(template)", std::chrono::duration<double>(Clock::now() - start).count(), result.rows.size());
+}
+
+// Peak resident set since the last resetPeakRss(), from /proc/self/status (Linux).
+static double peakRssMB() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmHWM:", 0) == 0) return std::stod(line.substr(6)) / 1024.0;
+  }
+  return -1;
+}
+
+// Brings the peak back to the current RSS (writing 5 to clear_refs, Linux 4.0+).
+static void resetPeakRss() {
+  std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+// Peak RSS while one large dump is executed into a spillBuffer, then into a string.
+static void benchSpill(const BenchConfig& config) {
+  size_t bytes = static_cast<size_t>(config.sessions ? config.sessions : 200) << 20;
+  MockServer server;
+
+  std::cout << std::left << std::setw(32) << "case"
+            << std::right << std::setw(12) << "MB"
+            << std::setw(12) << "ms"
+            << std::setw(16) << "peak RSS MB"
+            << std::setw(12) << "spilled" << "\n";
+
+  auto run = [&](const std::string& name, const std::function<unsigned int(session&, std::string&)>& execute) {
+    session s("127.0.0.1", "bench", "bench", server.port());
+    s._idle = 500;
+    s._timeout = 600000;
+    s._transport = transportOptions::throughput();
+    if (s.Connect() != RTELNET_SUCCESS) return;
+    drain(s);
+
+    resetPeakRss();
+    std::string spilled = "-";
+    auto start = Clock::now();
+    unsigned int status = execute(s, spilled);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (status != RTELNET_SUCCESS) std::cout << name << ": failed (" << status << ")\n";
+
+    std::cout << std::left << std::setw(32) << name
+              << std::right << std::setw(12) << std::fixed << std::setprecision(0) << bytes / (1024.0 * 1024.0)
+              << std::setw(12) << seconds * 1000.0
+              << std::setw(16) << std::setprecision(1) << peakRssMB()
+              << std::setw(12) << spilled << "\n";
+  };
+
+  const std::string command = "dump " + std::to_string(bytes);
+  run("Execute(spillBuffer), 8 MB", [&command](session& s, std::string& spilled) {
+    spillBuffer output;
+    unsigned int status = s.Execute(command, output);
+    spilled = output.spilled() ? "yes" : "no";
+    return status;
+  });
+  run("Execute(std::string)", [&command](session& s, std::string&) {
+    std::string output;
+    return s.Execute(command, output);
+  });
+}
+
+int main(int argc, char* argv[]) {
+  const std::map<std::string, std::function<void(const BenchConfig&)>> suites = {
+    {"transport", benchTransport},
+    {"mccp2", benchMCCP2},
+    {"profiles", benchProfiles},
+    {"push", benchPush},
+    {"gateway", benchGateway},
+    {"adaptive", benchAdaptive},
+    {"handshake", benchHandshake},
+    {"template", benchTemplate},
+    {"respond", benchRespond},
+    {"admission", benchAdmission},
+    {"spill", benchSpill},
+  };
+
+  std::string suite = (argc > 1) ? argv[1] : "all";
+  BenchConfig config;
+  if (argc > 2) config.sessions = std::atoi(argv[2]);
+  if (argc > 3) config.bytes = std::stoull(argv[3]);
+
+  for (const auto& [name, run] : suites) {
+    if (suite != "all" && suite != name) continue;
+    std::cout << "== " << name << " ==\n";
+    run(config);
+  }
+
+  return 0;
+}
@@ -0,0 +1,252 @@
+/*
+* Fuzz corpus harness for the session's protocol path, over memoryTransport.
+*
+* Every input is played as device output twice: once to a logged in session, cut
+* into reads at boundaries taken from the input itself, and once in the middle of
+* the handshake, between the option requests and the login prompt. The session's
+* output is then drained. Inputs are the built in seeds, the files of CORPUS_DIR
+* and, with MUTATIONS, that many random mutations of them (fixed seed, so a run can
+* be repeated).
+*
+* An input taking longer than BUDGET_MS fails the run like a crash would: the
+* harness writes it to relic-telnet-fuzz-slow.bin and exits 1, so a protocol path
+* that turned quadratic is caught with the input that shows it.
+*
+* Usage: relic-telnet-fuzz [CORPUS_DIR] [MUTATIONS] [BUDGET_MS]
+*        relic-telnet-fuzz --write-seeds DIR
+*
+* Built with -DRTELNET_LIBFUZZER -fsanitize=fuzzer it exports LLVMFuzzerTestOneInput
+* instead of main (CMake: -DRTELNET_LIBFUZZER=ON with Clang, target
+* relic-telnet-libfuzzer), the seeds written by --write-seeds then make its starting
+* corpus.
+*/
+#include "rtelnet.hpp"
+#include "rtelnet_transport.hpp"
+#include "memory_device.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace rtnt;
+using namespace rtnt_bench;
+using Clock = std::chrono::steady_clock;
+
+static std::string bytes(std::initializer_list<int> values) {
+  std::string out;
+  for (int value : values) out.push_back(static_cast<char>(value));
+  return out;
+}
+
+static std::vector<std::pair<std::string, std::string>> seeds() {
+  const int IAC = TelnetCommands::IAC, SB = TelnetCommands::SB, SE = TelnetCommands::SE;
+  const int DO = TelnetCommands::DO, DONT = TelnetCommands::DONT, WILL = TelnetCommands::WILL, WONT = TelnetCommands::WONT;
+
+  std::vector<std::pair<std::string, std::string>> list = {
+    {"plain", "show version\r\nCisco IOS Software, Version 15.2\r\nrouter1#"},
+    {"escaped-ff", "\xff\xff\xff\xff data \xff\xff"},
+    {"options", bytes({IAC, DO, 1, IAC, DONT, 3, IAC, WILL, 24, IAC, WONT, 31, IAC, DO, 200, IAC, WILL, 0})},
+    {"sb-ttype", bytes({IAC, SB, 24, 1, IAC, SE})},
+    {"sb-unterminated", bytes({IAC, SB, 24}) + std::string(100, 'x')},
+    {"sb-long", bytes({IAC, SB, 99}) + std::string(RTELNET_SB_MAX_SIZE + 100, 'y') + bytes({IAC, SE})},
+    {"sb-escaped", bytes({IAC, SB, 24, 0, IAC, IAC, 'v', 't', IAC, SE})},
+    {"mccp2-garbage", bytes({IAC, WILL, 86, IAC, SB, 86, IAC, SE}) + "not deflate at all"},
+    {"iac-at-end", "data" + bytes({IAC})},
+    {"commands", bytes({IAC, TelnetCommands::AYT, IAC, TelnetCommands::NOP, IAC, 249, IAC, 248})},
+    {"cr-nul", std::string("a\r\0b\r\nc\n\r", 9)},
+    {"prompts", "Proceed? [confirm]\r\n(y/n) Password: Login incorrect\r\n% Authentication failed\r\n"},
+    {"binary", bytes({IAC, WILL, 0, IAC, DO, 0}) + std::string(64, '\xff')},
+  };
+
+  std::string dense;
+  for (int i = 0; i < 4096; ++i) dense += bytes({IAC, (i % 2) ? DO : WILL, i % 256});
+  list.emplace_back("option-flood", dense);
+  return list;
+}
+
+// One input through one session, returns ms.
+static double play(const std::string& input, bool duringHandshake) {
+  auto device = memoryDevice();
+  device->_recordWrites = false;
+  if (duringHandshake) {
+    device->_onConnect = [connect = device->_onConnect, input](memoryTransport& self) {
+      self.deliver(bytes({TelnetCommands::IAC, TelnetCommands::DO, TelnetOptions::TERMINAL_TYPE}));
+      self.deliver(input);
+      connect(self);
+    };
+  }
+
+  auto start = Clock::now();
+  {
+    session s("memory", "fuzz", "fuzz");
+    s._stream = device;
+    s._login.timeout = 50;
+    s._idle = 5;
+
+    if (s.Connect() == RTELNET_SUCCESS && !duringHandshake) {
+      // Reads cut at input driven boundaries, 1 to 64 bytes.
+      size_t offset = 0;
+      uint32_t hash = 2166136261u;
+      while (offset < input.size() && s.isAlive()) {
+        hash = (hash ^ static_cast<unsigned char>(input[offset])) * 16777619u;
+        size_t piece = std::min<size_t>(1 + hash % 64, input.size() - offset);
+        device->deliver(std::string_view(input).substr(offset, piece));
+        // A session the input killed reads no more, stop feeding it then.
+        while (!device->waitDrained(10) && s.isAlive()) {}
+        offset += piece;
+      }
+    }
+
+    std::vector<unsigned char> out;
+    do {
+      out.clear();
+      s.Read(out, 1 << 20, 0, 1);
+    } while (!out.empty());
+
+    std::string reply;
+    if (s.isAlive() && s.isLoggedIn()) s.Expect("show clock", "$ ", reply, 100);
+  }
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static double playBoth(const std::string& input) {
+  return std::max(play(input, false), play(input, true));
+}
+
+// xorshift, reproducible across runs.
+struct mutator {
+  uint64_t state = 0x9E3779B97F4A7C15ull;
+
+  inline uint64_t next() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+
+  inline std::string mutate(std::string input, const std::vector<std::string>& corpus) {
+    int rounds = 1 + next() % 4;
+    for (int round = 0; round < rounds; ++round) {
+      size_t at = input.empty() ? 0 : next() % input.size();
+      switch (next() % 5) {
+        case 0: if (!input.empty()) input[at] = static_cast<char>(next()); break;
+        case 1: input.insert(at, bytes({TelnetCommands::IAC, static_cast<int>(236 + next() % 20)})); break;
+        case 2: if (!input.empty()) input.erase(at, 1 + next() % 16); break;
+        case 3: if (!input.empty()) input.insert(at, input.substr(at, 1 + next() % 64)); break;
+        default: {
+          const std::string& other = corpus[next() % corpus.size()];
+          if (!other.empty()) input.insert(at, other.substr(next() % other.size(), 1 + next() % 64));
+        }
+      }
+    }
+    return input;
+  }
+};
+
+#ifdef RTELNET_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  playBoth(std::string(reinterpret_cast<const char*>(data), size));
+  return 0;
+}
+#else
+static int usage(const char* program) {
+  std::cerr << "Usage: " << program << " [CORPUS_DIR] [MUTATIONS] [BUDGET_MS]\n"
+            << "       " << program << " --write-seeds DIR\n";
+  return 2;
+}
+
+// Whole argument as a non negative number, false for anything else.
+static bool parseNumber(const char* text, double& value) {
+  char* end = nullptr;
+  value = std::strtod(text, &end);
+  return end != text && *end == '\0' && value >= 0;
+}
+
+int main(int argc, char* argv[]) {
+  namespace fs = std::filesystem;
+
+  std::string first = (argc > 1) ? argv[1] : "";
+  if (first == "-h" || first == "--help") {
+    usage(argv[0]);
+    return 0;
+  }
+
+  if (first == "--write-seeds") {
+    if (argc != 3) return usage(argv[0]);
+
+    std::error_code error;
+    fs::create_directories(argv[2], error);
+    if (error) {
+      std::cerr << "cannot create " << argv[2] << ": " << error.message() << "\n";
+      return 1;
+    }
+    for (const auto& [name, input] : seeds()) {
+      std::ofstream file(fs::path(argv[2]) / (name + ".bin"), std::ios::binary);
+      if (!(file << input)) {
+        std::cerr << "cannot write " << (fs::path(argv[2]) / (name + ".bin")).string() << "\n";
+        return 1;
+      }
+    }
+    std::cout << "wrote " << seeds().size() << " seeds to " << argv[2] << "\n";
+    return 0;
+  }
+
+  double mutationCount = 0, budget = 1000;
+  if (argc > 4 || (!first.empty() && first[0] == '-')) return usage(argv[0]);
+  if (argc > 2 && !parseNumber(argv[2], mutationCount)) return usage(argv[0]);
+  if (argc > 3 && !parseNumber(argv[3], budget)) return usage(argv[0]);
+  std::string directory = first;
+  int mutations = static_cast<int>(mutationCount);
+
+  std::vector<std::pair<std::string, std::string>> corpus = seeds();
+  if (!directory.empty()) {
+    std::error_code error;
+    for (fs::directory_iterator entry(directory, error), end; !error && entry != end; entry.increment(error)) {
+      if (!entry->is_regular_file(error)) continue;
+      std::ifstream file(entry->path(), std::ios::binary);
+      std::ostringstream content;
+      content << file.rdbuf();
+      corpus.emplace_back(entry->path().filename().string(), content.str());
+    }
+    if (error) {
+      std::cerr << "cannot read corpus " << directory << ": " << error.message() << "\n";
+      return 1;
+    }
+  }
+
+  std::vector<std::string> inputs;
+  for (const auto& [name, input] : corpus) inputs.push_back(input);
+
+  double total = 0, slowest = 0;
+  std::string slowestName, slowestInput;
+  auto run = [&](const std::string& name, const std::string& input) {
+    double ms = playBoth(input);
+    total += ms;
+    if (ms > slowest) { slowest = ms; slowestName = name; slowestInput = input; }
+  };
+
+  for (const auto& [name, input] : corpus) run(name, input);
+  mutator random;
+  for (int i = 0; i < mutations; ++i) {
+    run("mutation " + std::to_string(i), random.mutate(inputs[random.next() % inputs.size()], inputs));
+  }
+
+  size_t played = corpus.size() + static_cast<size_t>(mutations);
+  std::cout << std::fixed << std::setprecision(2)
+            << "inputs " << played << ", total " << total << " ms, mean " << total / played
+            << " ms, slowest " << slowest << " ms (" << slowestName << ", " << slowestInput.size() << " bytes)\n";
+
+  if (slowest > budget) {
+    std::ofstream("relic-telnet-fuzz-slow.bin", std::ios::binary) << slowestInput;
+    std::cout << "over the " << budget << " ms budget, input written to relic-telnet-fuzz-slow.bin\n";
+    return 1;
+  }
+  return 0;
+}
+#endif
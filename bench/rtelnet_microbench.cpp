@@ -0,0 +1,234 @@
+/*
+* Relic Telnet protocol path microbenchmarks, run over memoryTransport.
+*
+* No socket and no peer process: the device is played in process, so the numbers
+* are those of the session code itself (telnet parsing, negotiation, Expect(),
+* command round trips) and a regression shows up at the function that caused it.
+*
+* Usage: relic-telnet-microbench [case] [iterations] [bytes]
+* (cases: iac, negotiation, expect, command, all)
+*/
+#include "rtelnet.hpp"
+#include "rtelnet_transport.hpp"
+#include "memory_device.hpp"
+#include "mock_server.hpp"
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+
+using namespace rtnt;
+using namespace rtnt_bench;
+using Clock = std::chrono::steady_clock;
+
+struct MicroConfig {
+  int iterations = 0;      // 0 = case default
+  size_t bytes = 8 << 20;
+};
+
+static void printHeader() {
+  std::cout << std::left << std::setw(32) << "case"
+            << std::right << std::setw(12) << "work"
+            << std::setw(12) << "ms"
+            << std::setw(14) << "rate" << "  unit\n";
+}
+
+static void printRow(const std::string& name, double work, double seconds, const std::string& unit, double rate) {
+  std::cout << std::left << std::setw(32) << name
+            << std::right << std::setw(12) << std::fixed << std::setprecision(0) << work
+            << std::setw(12) << std::setprecision(1) << seconds * 1000.0
+            << std::setw(14) << std::setprecision(1) << rate << "  " << unit << "\n";
+}
+
+// A logged in session on its own in process device, banner already read.
+static std::unique_ptr<session> loggedIn(const std::shared_ptr<memoryTransport>& device) {
+  auto s = std::make_unique<session>("memory", "bench", "bench");
+  s->_stream = device;
+  s->_transport.readChunk = 64 << 10;
+  if (s->Connect() != RTELNET_SUCCESS) return nullptr;
+
+  std::vector<unsigned char> out;
+  do {
+    out.clear();
+    s->Read(out, 1 << 20, 0, 5);
+  } while (!out.empty());
+  return s;
+}
+
+// Wire bytes in, data bytes out of the shared buffer, for inputs of different IAC density.
+static void benchIAC(const MicroConfig& config) {
+  const std::string text = MockServer::payload(config.bytes);
+
+  auto run = [&](const std::string& name, const std::function<void(std::string&, char)>& encode) {
+    std::string wire;
+    wire.reserve(text.size() * 2);
+    for (char c : text) encode(wire, c);
+
+    auto device = memoryDevice();
+    device->_recordWrites = false;
+    auto s = loggedIn(device);
+    if (!s) return;
+
+    uint64_t before = s->getMetrics().bytesDelivered;
+    auto start = Clock::now();
+    device->deliver(wire);
+
+    size_t received = 0;
+    std::vector<unsigned char> out;
+    while (received < text.size()) {
+      out.clear();
+      s->Read(out, 1 << 20, 0, 5000);
+      if (out.empty()) break;
+      received += out.size();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double megabytes = wire.size() / (1024.0 * 1024.0);
+
+    if (s->getMetrics().bytesDelivered - before != text.size()) std::cout << name << ": short read\n";
+    printRow(name, megabytes, seconds, "MB/s on the wire", megabytes / seconds);
+  };
+
+  printHeader();
+  run("plain text", [](std::string& wire, char c) { wire.push_back(c); });
+  run("every 8th byte 0xFF (escaped)", [n = 0](std::string& wire, char c) mutable {
+    if (++n % 8 == 0) wire.append("\xff\xff", 2);
+    else wire.push_back(c);
+  });
+  run("IAC NOP every 32 bytes", [n = 0](std::string& wire, char c) mutable {
+    if (++n % 32 == 0) wire.append("\xff\xf1", 2);
+    wire.push_back(c);
+  });
+}
+
+// Whole handshakes (options, login) and option requests answered mid session.
+static void benchNegotiation(const MicroConfig& config) {
+  int connects = config.iterations ? config.iterations : 500;
+  int requests = config.iterations ? config.iterations * 100 : 100000;
+
+  printHeader();
+
+  {
+    auto device = memoryDevice();
+    device->_recordWrites = false;
+    auto start = Clock::now();
+    int done = 0;
+    for (int i = 0; i < connects; ++i) {
+      session s("memory", "bench", "bench");
+      s._stream = device;
+      if (s.Connect() == RTELNET_SUCCESS) ++done;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printRow("Connect() and login", done, seconds, "handshakes/s", done / seconds);
+  }
+
+  {
+    auto device = memoryDevice();
+    auto s = loggedIn(device);
+    if (!s) return;
+    device->takeWritten();
+
+    // Requests the client refuses or accepts, each one answered with 3 bytes.
+    const unsigned char options[] = {TelnetOptions::ECHO, TelnetOptions::SGA, TelnetOptions::TERMINAL_TYPE, 99};
+    std::string wire;
+    for (int i = 0; i < requests; ++i) {
+      wire.push_back(static_cast<char>(TelnetCommands::IAC));
+      wire.push_back(static_cast<char>((i % 2) ? TelnetCommands::WILL : TelnetCommands::DO));
+      wire.push_back(static_cast<char>(options[i % 4]));
+    }
+
+    auto start = Clock::now();
+    device->deliver(wire);
+    device->waitDrained(10000);
+    size_t expected = static_cast<size_t>(requests) * 3;
+    for (int spin = 0; device->written().size() < expected && spin < 10000; ++spin) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    size_t answered = device->written().size() / 3;
+    printRow("option requests answered", static_cast<double>(answered), seconds, "requests/s", answered / seconds);
+  }
+}
+
+// Expect() scanning large replies for a marker at their end.
+static void benchExpect(const MicroConfig& config) {
+  int calls = config.iterations ? config.iterations : 20;
+  const std::string body = MockServer::payload(config.bytes / 8);
+
+  auto device = memoryDevice([&body](const std::string& line) {
+    if (line.rfind("dump", 0) == 0) return line + "\r\n" + body + "\r\nEND OF DUMP\r\n$ ";
+    return line + "\r\n$ ";
+  });
+  device->_recordWrites = false;
+  auto s = loggedIn(device);
+  if (!s) return;
+
+  printHeader();
+  std::string output;
+  auto start = Clock::now();
+  for (int i = 0; i < calls; ++i) {
+    output.clear();
+    if (s->Expect("dump", "END OF DUMP", output, 5000) != RTELNET_SUCCESS) {
+      std::cout << "expect failed\n";
+      return;
+    }
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  double megabytes = static_cast<double>(body.size()) * calls / (1024.0 * 1024.0);
+  printRow("Expect(), marker at the end", megabytes, seconds, "MB/s", megabytes / seconds);
+}
+
+// Round trip of a one line command through the session, the device answers at once.
+static void benchCommand(const MicroConfig& config) {
+  int commands = config.iterations ? config.iterations : 20000;
+
+  auto device = memoryDevice();
+  device->_recordWrites = false;
+  auto s = loggedIn(device);
+  if (!s) return;
+
+  printHeader();
+  std::string output;
+  auto start = Clock::now();
+  for (int i = 0; i < commands; ++i) {
+    output.clear();
+    if (s->Expect("show clock", "$ ", output, 5000) != RTELNET_SUCCESS) {
+      std::cout << "command failed\n";
+      return;
+    }
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  printRow("Expect() per command", commands, seconds, "us/command", seconds * 1e6 / commands);
+
+  start = Clock::now();
+  std::vector<std::future<commandResult>> futures;
+  int queued = std::min(commands, 2000);
+  s->_idle = 1;
+  for (int i = 0; i < queued; ++i) futures.push_back(s->Submit("show clock"));
+  for (auto& future : futures) future.get();
+  seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  printRow("Submit(), 1 ms idle", queued, seconds, "us/command", seconds * 1e6 / queued);
+}
+
+int main(int argc, char* argv[]) {
+  const std::map<std::string, std::function<void(const MicroConfig&)>> cases = {
+    {"iac", benchIAC},
+    {"negotiation", benchNegotiation},
+    {"expect", benchExpect},
+    {"command", benchCommand},
+  };
+
+  std::string selected = (argc > 1) ? argv[1] : "all";
+  MicroConfig config;
+  if (argc > 2) config.iterations = std::atoi(argv[2]);
+  if (argc > 3) config.bytes = std::stoull(argv[3]);
+
+  for (const auto& [name, run] : cases) {
+    if (selected != "all" && selected != name) continue;
+    std::cout << "== " << name << " ==\n";
+    run(config);
+  }
+
+  return 0;
+}
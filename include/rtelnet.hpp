@@ -13,12 +13,14 @@
 #include <iostream>
 #include <cerrno>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <ostream>
 #include <string_view>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string>
 #include <sys/types.h>
 #include <unistd.h>
@@ -27,9 +29,31 @@
 #include <chrono>
 #include <thread>
 #include <sys/select.h>
+#include <sys/epoll.h>
 #include <map>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <fstream>
+
+#include "rtelnet_timer.hpp"
+#include "rtelnet_queue.hpp"
+#include "rtelnet_cache.hpp"
+#include "rtelnet_spill.hpp"
+#include "rtelnet_adaptive.hpp"
+#include "rtelnet_negotiation.hpp"
+#include "rtelnet_template.hpp"
+#include "rtelnet_admission.hpp"
+#include <future>
+
+#ifdef RTELNET_WITH_IO_URING
+#include <liburing.h>
+#endif
+
+#ifdef RTELNET_WITH_ZLIB
+#include <zlib.h>
+#endif
 
 #define LV(x) #x, x
 #define PUSH_ERROR(code) pushError(code, __LINE__, __func__)
@@ -44,6 +68,19 @@ inline constexpr int RTELNET_TOTAL_TIMEOUT       = 10000;
 inline constexpr int RTELNET_DEBUG               = 0;
 inline constexpr int RTELNET_LOGIN_TIMEOUT       = 3000; // ms
 inline constexpr int RTELNET_NEGOTIATION_TIMEOUT = 3; // s
+inline constexpr int RTELNET_READ_WAIT           = 1000; // ms, single transport wait
+inline constexpr int RTELNET_URING_ENTRIES       = 64;
+inline constexpr int RTELNET_URING_BUFFERS       = 64; // Must be a power of two
+inline constexpr int RTELNET_URING_BUFFER_GROUP  = 0;
+inline constexpr int RTELNET_SB_MAX_SIZE         = 4096; // Subnegotiation payload bytes kept
+inline constexpr int RTELNET_READ_CHUNK_MAX      = 16 << 20; // Largest transportOptions::readChunk
+inline constexpr int RTELNET_INFLATE_CHUNK       = 16384;
+inline constexpr int RTELNET_HEARTBEAT_TIMEOUT   = 5000; // ms an AYT may stay unanswered
+inline constexpr int RTELNET_EXPECT_TIMEOUT      = 60000; // ms
+inline constexpr size_t RTELNET_PUSH_WINDOW       = 8;    // Lines in flight
+inline constexpr size_t RTELNET_PUSH_WINDOW_BYTES = 1024; // Bytes in flight
+inline constexpr int RTELNET_PUSH_LINE_TIMEOUT    = 30000; // ms without data while lines are in flight
+inline constexpr size_t RTELNET_ERROR_STACK_MAX   = 256; // Oldest errors are dropped past this
 
 // Log titles
 inline constexpr std::string_view RTELNET_LOG_TCP_SET_ADDR = "TCP => SETTING SOCKET ADDRESS";
@@ -52,12 +89,20 @@ inline constexpr std::string_view RTELNET_LOG_TCP_CLOSE = "TCP => CLOSING SOCKET
 inline constexpr std::string_view RTELNET_LOG_TCP_SEND_BIN = "TCP => SEND BIN";
 inline constexpr std::string_view RTELNET_LOG_TCP_SEND = "TCP => SEND";
 inline constexpr std::string_view RTELNET_LOG_TCP_READ = "TCP => READ";
+inline constexpr std::string_view RTELNET_LOG_TCP_BACKEND = "TCP => BACKEND";
+inline constexpr std::string_view RTELNET_LOG_TCP_OPTIONS = "TCP => SOCKET OPTIONS";
 inline constexpr std::string_view RTELNET_LOG_CONNECT = "CONNECT";
 inline constexpr std::string_view RTELNET_LOG_EXECUTE = "EXECUTE";
 inline constexpr std::string_view RTELNET_LOG_NEGOTIATE = "NEGOTIATE";
 inline constexpr std::string_view RTELNET_LOG_LOGIN = "LOGIN";
 inline constexpr std::string_view RTELNET_LOG_IAC_READER = "IAC READER";
 inline constexpr std::string_view RTELNET_LOG_PTELNET = "TELNET";
+inline constexpr std::string_view RTELNET_LOG_MCCP = "MCCP2";
+inline constexpr std::string_view RTELNET_LOG_HEARTBEAT = "HEARTBEAT";
+inline constexpr std::string_view RTELNET_LOG_RECONNECT = "RECONNECT";
+inline constexpr std::string_view RTELNET_LOG_QUEUE = "QUEUE";
+inline constexpr std::string_view RTELNET_LOG_PUSH = "PUSH";
+inline constexpr std::string_view RTELNET_LOG_RESPOND = "AUTO RESPOND";
 
 namespace rtnt {
 
@@ -74,6 +119,11 @@ namespace rtnt {
     NOT_CONNECTED          = 213,
     FAILED_SEND            = 214,
     PARTIAL_SEND           = 215,
+    BACKEND_NOT_AVAILABLE  = 216,
+    BACKEND_SETUP_FAILED   = 217,
+    GATEWAY_UNAVAILABLE    = 218,
+    GATEWAY_PROTOCOL       = 219,
+    GATEWAY_POOL_FULL      = 220,
   
     // 300 > : Telnet logic errors.
     NOT_A_NEGOTIATION      = 300,
@@ -84,7 +134,22 @@ namespace rtnt {
     FAILED_LOGIN           = 305,
     IAC_READER_FAILED_NEGO = 306,
     SHARED_BUFFER_EMPTY    = 307,
-    NEGOTIATION_TIMEOUT    = 308
+    NEGOTIATION_TIMEOUT    = 308,
+    COMPRESSION_FAILED     = 309,
+    HEARTBEAT_FAILED       = 310,
+    SESSION_DEAD           = 311,
+    PUSH_LINE_FAILED       = 312,
+    PUSH_TIMEOUT           = 313,
+    TEMPLATE_FAILED        = 314,
+    ADMISSION_TIMEOUT      = 315,
+    ADMISSION_NOT_SHARED   = 316
+  };
+
+  // How tcp waits for and receives incoming bytes.
+  enum TransportBackend {
+    SELECT   = 0, // select() + recv() per chunk (default)
+    EPOLL    = 1, // epoll_wait() + recv() per chunk, persistent interest list
+    IO_URING = 2  // Multishot recv into a registered buffer ring (needs RTELNET_WITH_IO_URING)
   };
 
   enum TelnetCommands : unsigned char {
@@ -94,7 +159,9 @@ namespace rtnt {
     WILL = 251, // I will use this option
     WONT = 252, // I won’t use this option
     SB   = 250, // Begin subnegotiation
-    SE   = 240  // End subnegotiation
+    SE   = 240, // End subnegotiation
+    NOP  = 241, // No operation
+    AYT  = 246  // Are You There
   };
 
   enum TelnetOptions : unsigned char {
@@ -165,6 +232,11 @@ namespace rtnt {
       case Errors::NOT_CONNECTED: return            "connection failed, tcp session was not established.";
       case Errors::FAILED_SEND: return              "could not send message. (No errno just 0 bytes sent)";
       case Errors::PARTIAL_SEND: return             "message was sent partially.";
+      case Errors::BACKEND_NOT_AVAILABLE: return    "transport backend is not compiled in.";
+      case Errors::BACKEND_SETUP_FAILED: return     "transport backend setup failed.";
+      case Errors::GATEWAY_UNAVAILABLE: return      "cannot reach the relic-telnetd gateway.";
+      case Errors::GATEWAY_PROTOCOL: return         "malformed frame from the relic-telnetd gateway.";
+      case Errors::GATEWAY_POOL_FULL: return        "relic-telnetd session pool is full and every session is busy.";
 
       // Telnet logic errors
       case Errors::NOT_A_NEGOTIATION: return        "a negotiation was called, yet server did not negotiate.";
@@ -179,11 +251,157 @@ namespace rtnt {
       case Errors::IAC_READER_FAILED_NEGO: return   "IAC reader failed while re negotiating.";
       case Errors::SHARED_BUFFER_EMPTY: return      "Read failed, the shared buffer is empty.";
       case Errors::NEGOTIATION_TIMEOUT: return      "Timeout while waiting for negotiation.";
+      case Errors::COMPRESSION_FAILED: return       "MCCP2 stream could not be decompressed.";
+      case Errors::HEARTBEAT_FAILED: return         "heartbeat failed, peer is not responding.";
+      case Errors::SESSION_DEAD: return             "session is dead, reconnect first.";
+      case Errors::PUSH_LINE_FAILED: return         "device rejected one or more pushed lines.";
+      case Errors::PUSH_TIMEOUT: return             "timeout while waiting for the device to acknowledge a line.";
+      case Errors::TEMPLATE_FAILED: return          "template is not compiled or an Error rule matched the output.";
+      case Errors::ADMISSION_TIMEOUT: return        "timeout while queued for admission to connect.";
+      case Errors::ADMISSION_NOT_SHARED: return     "admission controller must be created with std::make_shared.";
 
       default: return                               "Unknown error.";
     }
   }
 
+  // Counters kept by the reader, readable from any thread.
+  struct sessionMetrics {
+    std::atomic<uint64_t> bytesOnWire{0};    // Raw bytes received from the socket
+    std::atomic<uint64_t> bytesInflated{0};  // Bytes produced by MCCP2 decompression
+    std::atomic<uint64_t> bytesDelivered{0}; // Data bytes handed to the shared buffer
+    std::atomic<uint64_t> heartbeatsSent{0};
+    std::atomic<uint64_t> reconnects{0};
+    std::atomic<uint64_t> commandsSubmitted{0};
+    std::atomic<uint64_t> commandsCompleted{0};
+    std::atomic<uint64_t> lateOutputs{0};    // Output that arrived after its command was cut off
+    std::atomic<int> idleCutoff{0};          // ms, last idle cutoff between two chunks
+    std::atomic<uint64_t> earlyAnswers{0};   // Option answers sent before the server asked
+    std::atomic<int> handshakeMs{0};         // Last Connect(), socket connected to logged in
+    std::atomic<uint64_t> autoResponses{0};  // Answers sent by auto responder rules
+    std::atomic<int> admissionWaitMs{0};     // Last Connect(), time queued in _admission
+  };
+
+  // Outcome of a queued command, see session::Submit().
+  struct commandResult {
+    unsigned int status = RTELNET_SUCCESS;
+    std::string output;
+  };
+
+  // Byte stream a session can run over instead of its TCP socket, see session::_stream.
+  // Status codes are the session's (RTELNET_SUCCESS, Errors or errno values).
+  class streamTransport {
+  public:
+    virtual ~streamTransport() = default;
+
+    virtual unsigned int connect(const std::string& address, int port) = 0;
+
+    // Replaces `buffer` with up to `size` bytes. Waits up to `waitMs`, an empty buffer
+    // means nothing arrived. The peer going away is CONNECTION_CLOSED_R.
+    virtual unsigned int read(std::vector<unsigned char>& buffer, size_t size, int waitMs) = 0;
+
+    // All of it or an error.
+    virtual unsigned int write(const unsigned char* data, size_t size) = 0;
+
+    // Wakes a read() blocked on another thread, reads fail until the next connect().
+    virtual void interrupt() = 0;
+
+    virtual void close() = 0;
+
+    // Called once the login is done, the TCP transport restores its Nagle setting.
+    virtual void endHandshake() {}
+  };
+
+  // Socket tuning applied by tcpTransport::connect(), 0 keeps the kernel default (readChunk excepted).
+  struct transportOptions {
+    bool noDelay = false;                // TCP_NODELAY, send small writes without waiting on Nagle
+    bool quickAck = false;               // TCP_QUICKACK, re armed after every recv (not sticky)
+    int receiveBuffer = 0;               // SO_RCVBUF bytes
+    int sendBuffer = 0;                  // SO_SNDBUF bytes
+    int readChunk = RTELNET_BUFFER_SIZE; // Bytes per recv, also the size of each io_uring buffer (<= 0 uses the default)
+    int busyPoll = 0;                    // SO_BUSY_POLL us, may need CAP_NET_ADMIN
+    int userTimeout = 0;                 // TCP_USER_TIMEOUT ms, unacked data before the kernel drops us
+    bool keepAlive = false;              // SO_KEEPALIVE
+    int keepIdle = 0;                    // TCP_KEEPIDLE s before the first probe
+    int keepInterval = 0;                // TCP_KEEPINTVL s between probes
+    int keepCount = 0;                   // TCP_KEEPCNT unanswered probes before the kernel drops us
+
+    // Interactive exchanges: no Nagle, no delayed ACK, fail fast. Single round trips
+    // cost the same as with the defaults, commands in flight do not wait on delayed
+    // ACKs (relic-telnet-bench profiles: 8 pipelined commands ~70 us vs ~44 ms).
+    static transportOptions lowLatency() {
+      transportOptions options;
+      options.noDelay = true;
+      options.quickAck = true;
+      options.readChunk = 4096;
+      options.busyPoll = 50;
+      options.userTimeout = 10000;
+      return options;
+    }
+
+    // Bulk output (config dumps, show tech): big kernel buffers, few large reads.
+    static transportOptions throughput() {
+      transportOptions options;
+      options.noDelay = true;
+      options.receiveBuffer = 4 << 20;
+      options.sendBuffer = 1 << 20;
+      options.readChunk = 64 << 10;
+      options.userTimeout = 30000;
+      return options;
+    }
+  };
+
+  // Telnet level liveness check sent by the reader when the session is idle.
+  struct heartbeatOptions {
+    int idle = 0;                                  // ms without incoming data before a heartbeat, 0 disables it
+    unsigned char command = TelnetCommands::NOP;   // NOP (silent) or AYT (server answers with text)
+    int timeout = RTELNET_HEARTBEAT_TIMEOUT;       // ms an AYT may stay unanswered
+    std::string reply = "[Yes]";                   // Visible AYT answer, taken out of the output (empty keeps it)
+  };
+
+  // Flow control for Push(), a line stays in flight until the device acknowledges it.
+  struct pushOptions {
+    size_t window = RTELNET_PUSH_WINDOW;             // Lines in flight
+    size_t windowBytes = RTELNET_PUSH_WINDOW_BYTES;  // Bytes in flight, keep it under the device's input buffer
+    std::string prompt = "#";                        // Acknowledge on this prompt (IOS config modes end in '#')
+                                                     // Empty acknowledges on each line's echo, only for devices that
+                                                     // echo anyway (we answer WILL ECHO with DONT ECHO)
+    std::vector<std::string> errorPatterns = {"% Invalid", "% Incomplete", "% Ambiguous", "% Unknown", "Error:"};
+    bool stopOnError = false;                        // Send nothing more after the first rejected line
+    int lineTimeout = RTELNET_PUSH_LINE_TIMEOUT;     // ms without any data while lines are in flight
+  };
+
+  // What Login() reacts to. Username and password prompts match the end of the
+  // device output, trailing spaces ignored, failures match anywhere in the output
+  // that follows the username or password.
+  struct loginOptions {
+    std::vector<std::string> usernamePrompts = {"login:", "Username:"};
+    std::vector<std::string> passwordPrompts = {"Password:"};
+    std::vector<std::string> prompts = {"$", "#", ">"};  // Shell prompt, logged in
+    std::vector<std::string> failures = {"Login incorrect", "% Authentication failed", "Access denied"};
+    int timeout = RTELNET_LOGIN_TIMEOUT;                 // ms per step without a match
+  };
+
+  // Answer sent by the reader as soon as `pattern` shows up in the output, see
+  // session::AutoRespond(). Patterns are plain text like the login prompts.
+  struct autoResponse {
+    std::string pattern;   // e.g. "[confirm]", "(y/n)", "Destination filename"
+    std::string response;  // Sent as is, include the "\n" if the device wants Enter
+    int maxFires = 1;      // 0 = no limit
+    uint64_t fired = 0;    // Times it answered so far
+  };
+
+  struct pushLineError {
+    size_t line = 0;       // Index in the pushed lines
+    std::string text;
+    std::string response;  // Device output for that line
+  };
+
+  struct pushReport {
+    size_t sent = 0;
+    size_t acknowledged = 0;
+    std::vector<pushLineError> errors;
+  };
+
   class session {
   public:
     int _port = RTELNET_PORT;
@@ -194,6 +412,31 @@ namespace rtnt {
     std::string _password;
     int _idle = RTELNET_IDLE_TIMEOUT;
     int _timeout = RTELNET_TOTAL_TIMEOUT;
+    TransportBackend _backend = TransportBackend::SELECT;
+    bool _mccp2 = true; // Accept WILL MCCP2 (only with RTELNET_WITH_ZLIB)
+    transportOptions _transport;
+    heartbeatOptions _heartbeat;
+    loginOptions _login;
+
+    // Optional result cache in front of Execute(), may be shared between sessions.
+    std::shared_ptr<commandCache> _cache;
+
+    // Learns the idle timeout per host instead of using _idle, may be shared between sessions.
+    std::shared_ptr<idleProfiles> _idleProfiles;
+
+    // Remembers each host's option requests and answers them as soon as the socket connects.
+    std::shared_ptr<negotiationProfiles> _negotiationProfiles;
+
+    // Replaces the TCP socket when set, the address and port are only passed along.
+    // rtnt::memoryTransport (rtelnet_transport.hpp) plays the device in process.
+    std::shared_ptr<streamTransport> _stream;
+
+    // Paces connects and caps concurrent sessions, shared by the sessions it governs.
+    // Connect() queues for a ticket, held until the connection closes.
+    std::shared_ptr<admissionController> _admission;
+
+    // Fired on a helper thread once the session is marked dead, may call Reconnect().
+    std::function<void(session&)> _reconnectCallback;
 
     session(
       const char* address,
@@ -217,12 +460,24 @@ namespace rtnt {
       _logger(this) {}
 
     ~session() {
+      _closing = true;
+      stopDispatcher();
+
+      {
+        std::lock_guard<std::mutex> lock(_reconnectMutex);
+        if (_reconnector.joinable()) _reconnector.join();
+      }
+
       _stopBackground = true;
 
+      // Wakes the reader out of its transport wait instead of letting it time out.
+      _tcp.Interrupt();
+
       if (_background.joinable()) {
         _background.join();
       }
 
+      endCompression();
       _tcp.Close();
     }
 
@@ -412,6 +667,7 @@ namespace rtnt {
     };
 
     inline void throwErrorStack() {
+        std::lock_guard<std::mutex> lock(_errorMutex);
         std::cerr << "[Error Stack Trace]" << std::endl;
 
         for (size_t i = 0; i < errorStack.size(); ++i) {
@@ -426,114 +682,420 @@ namespace rtnt {
         }
     }
 
-    class tcp {
+    // The socket transport: TCP socket, its options and the select/epoll/io_uring
+    // read backends. Settings are read from the owning session on every connect().
+    class tcpTransport : public streamTransport {
     public:
-      tcp(session* owner) : _owner(owner) {}
+      tcpTransport(session* owner) : _owner(owner) {}
+
+      ~tcpTransport() override { close(); }
+
+      inline unsigned int connect(const std::string& host, int port) override {
+        sockaddr_in address{};
+        address.sin_family = (_owner->_ipv == 4) ? AF_INET : AF_INET6;
+        address.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) <= 0) return Errors::ADDRESS_NOT_VALID;
+
+        _owner->_logger.log(RTELNET_LOG_TCP_SET_ADDR, "Successfully set socket address.", 4, LV(host), LV(port));
+
+        int sockfd = socket((_owner->_ipv == 4) ? AF_INET : AF_INET6, SOCK_STREAM, 0);
+        if (sockfd < 0) return Errors::CANNOT_ALLOCATE_FD;
 
-      inline unsigned int setSocketAddr(sockaddr_in& server_address) const {
-        server_address.sin_family = (_owner->_ipv == 4) ? AF_INET : AF_INET6;
-        server_address.sin_port = htons(_owner->_port);
+        // Buffer sizes must be set before connect() to affect the window scale.
+        applyOptions(sockfd);
 
-        if (inet_pton(AF_INET, _owner->_address, &server_address.sin_addr) <= 0) {
-          return _owner->PUSH_ERROR(Errors::ADDRESS_NOT_VALID);
+        errno = 0;
+        if (::connect(sockfd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+          int error = errno;
+          ::close(sockfd);
+          return error;
         }
-        
-        _owner->_logger.log(RTELNET_LOG_TCP_SET_ADDR, "Successfully set socket address.", 4, LV(_owner->_address), LV(_owner->_port));
 
+        _owner->_logger.log(RTELNET_LOG_TCP_CONNECT, "Successfully connected.", 4, LV(host), LV(port));
+
+        unsigned int backendStatus = setupBackend(sockfd);
+        if (backendStatus != RTELNET_SUCCESS) {
+          ::close(sockfd);
+          return backendStatus;
+        }
+
+        _fd = sockfd;
         return RTELNET_SUCCESS;
       }
 
-      inline unsigned int Connect(sockaddr_in& address) {
-        int sockfd = socket((_owner->_ipv == 4) ? AF_INET : AF_INET6, SOCK_STREAM, 0);
-        if (sockfd < 0) return _owner->PUSH_ERROR(Errors::CANNOT_ALLOCATE_FD);
+      inline unsigned int read(std::vector<unsigned char>& buffer, size_t size, int waitMs) override {
+        int readSize = static_cast<int>(size);
+        switch (_owner->_backend) {
+          case TransportBackend::EPOLL:    return readEpoll(buffer, readSize, waitMs);
+          case TransportBackend::IO_URING: return readUring(buffer, readSize, waitMs);
+          default:                         return readSelect(buffer, readSize, waitMs);
+        }
+      }
 
+      // No SIGPIPE from a peer that went away, the error comes back as EPIPE.
+      inline unsigned int write(const unsigned char* data, size_t size) override {
         errno = 0;
-        if (connect(sockfd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) { return _owner->PUSH_ERROR(errno); }
+        ssize_t bytesSent = send(_fd, data, size, MSG_NOSIGNAL);
 
-        _owner->_logger.log(RTELNET_LOG_TCP_CONNECT, "Successfully connected.", 4, LV(_owner->_address), LV(_owner->_port));
-        
-        _owner->_connected = true;
-        return sockfd;
+        if (bytesSent == 0) return Errors::FAILED_SEND;
+        if (bytesSent < 0) return errno;
+        if (static_cast<size_t>(bytesSent) != size) return Errors::PARTIAL_SEND;
+        return RTELNET_SUCCESS;
       }
 
-      void Close() {
-        close(_owner->_fd); 
-        _owner->_logger.log(RTELNET_LOG_TCP_CLOSE, "Closed socket.", 4);
-        _owner->_connected = false;
+      inline void interrupt() override {
+        if (_fd >= 0) shutdown(_fd, SHUT_RDWR);
       }
 
-      inline unsigned int SendBin(const std::vector<unsigned char>& message, int sendFlag = 0) const {
-        if (!_owner->_connected) return _owner->PUSH_ERROR(Errors::NOT_CONNECTED);
+      inline void close() override {
+        teardownBackend();
+        if (_fd >= 0) ::close(_fd);
+        _fd = -1;
+      }
 
-        errno = 0;
-        ssize_t bytesSent = send(_owner->_fd, message.data(), message.size(), sendFlag);
+      // Back to the configured Nagle setting once logged in, see quickAck().
+      inline void endHandshake() override {
+        if (_fd >= 0 && !_owner->_transport.noDelay) setOption(_fd, IPPROTO_TCP, TCP_NODELAY, 0, "TCP_NODELAY");
+      }
 
-        if (bytesSent == 0) return _owner->PUSH_ERROR(Errors::FAILED_SEND);
-        if (static_cast<size_t>(bytesSent) != message.size()) return _owner->PUSH_ERROR(Errors::PARTIAL_SEND);
-        if (bytesSent < 0) return _owner->PUSH_ERROR(errno);
+    private:
+      session* _owner;
+      int _fd = -1;
+      int _epfd = -1;
+      int _ringBufferSize = RTELNET_BUFFER_SIZE;
+
+      // Best effort, a refused option is logged and the connection goes on with the default.
+      inline void setOption(int sockfd, int level, int name, int value, const char* label) const {
+        if (setsockopt(sockfd, level, name, &value, sizeof(value)) < 0) {
+          _owner->_logger.log(RTELNET_LOG_TCP_OPTIONS, "Failed to set socket option.", 3, LV(label), LV(value), LV(errno));
+          return;
+        }
+        _owner->_logger.log(RTELNET_LOG_TCP_OPTIONS, "Set socket option.", 4, LV(label), LV(value));
+      }
 
-        _owner->_logger.log(RTELNET_LOG_TCP_SEND_BIN, "Successfully sent message.", 4, LV(message), LV(sendFlag));
+      // The handshake is a ping pong of small writes where Nagle on one end and a
+      // delayed ACK on the other cost ~40 ms per exchange, so until Login() is done
+      // both are off whatever _transport says.
+      inline bool quickAck() const {
+        return _owner->_transport.quickAck || !_owner->_logged_in;
+      }
 
-        return RTELNET_SUCCESS;
+      inline void applyOptions(int sockfd) const {
+        const transportOptions& options = _owner->_transport;
+
+        setOption(sockfd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY"); // Restored by endHandshake()
+        if (quickAck())                setOption(sockfd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+        if (options.receiveBuffer > 0) setOption(sockfd, SOL_SOCKET, SO_RCVBUF, options.receiveBuffer, "SO_RCVBUF");
+        if (options.sendBuffer > 0)    setOption(sockfd, SOL_SOCKET, SO_SNDBUF, options.sendBuffer, "SO_SNDBUF");
+        if (options.userTimeout > 0)   setOption(sockfd, IPPROTO_TCP, TCP_USER_TIMEOUT, options.userTimeout, "TCP_USER_TIMEOUT");
+#ifdef SO_BUSY_POLL
+        if (options.busyPoll > 0)      setOption(sockfd, SOL_SOCKET, SO_BUSY_POLL, options.busyPoll, "SO_BUSY_POLL");
+#endif
+        if (options.keepAlive)         setOption(sockfd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+        if (options.keepIdle > 0)      setOption(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, options.keepIdle, "TCP_KEEPIDLE");
+        if (options.keepInterval > 0)  setOption(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, options.keepInterval, "TCP_KEEPINTVL");
+        if (options.keepCount > 0)     setOption(sockfd, IPPROTO_TCP, TCP_KEEPCNT, options.keepCount, "TCP_KEEPCNT");
       }
 
-      inline unsigned int Send(const std::string& message, int sendFlag = 0) const {
-        if (!_owner->_connected) return _owner->PUSH_ERROR(Errors::NOT_CONNECTED);
+#ifdef RTELNET_WITH_IO_URING
+      // Completions of the multishot recv land in buffers owned by _ringStorage,
+      // are copied to _pending and the buffer is handed straight back to the kernel.
+      io_uring _ring{};
+      io_uring_buf_ring* _bufRing = nullptr;
+      std::vector<unsigned char> _ringStorage;
+      std::vector<unsigned char> _pending;
+      size_t _pendingOffset = 0;
+      bool _ringReady = false;
+      bool _recvArmed = false;
+      bool _peerClosed = false;
+      static constexpr __u64 _recvTag = 1;
+#endif
+
+      inline unsigned int setupBackend(int sockfd) {
+        switch (_owner->_backend) {
+          case TransportBackend::SELECT:
+            return RTELNET_SUCCESS;
 
-        std::vector<unsigned char> buffer;
-        buffer.reserve(message.size());
+          case TransportBackend::EPOLL: {
+            _epfd = epoll_create1(EPOLL_CLOEXEC);
+            if (_epfd < 0) return Errors::BACKEND_SETUP_FAILED;
+
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = sockfd;
+            if (epoll_ctl(_epfd, EPOLL_CTL_ADD, sockfd, &event) < 0) {
+              ::close(_epfd);
+              _epfd = -1;
+              return Errors::BACKEND_SETUP_FAILED;
+            }
 
-        // Escape 255/0xFF unless full duplex binary communication.
-        for (unsigned char c : message) {
-          buffer.push_back(c);
-          if (!(_owner->_binarySendEnabled && _owner->_binaryReceiveEnabled) && c == 255) buffer.push_back(255);
-        }
+            _owner->_logger.log(RTELNET_LOG_TCP_BACKEND, "Using epoll backend.", 4, LV(_epfd));
+            return RTELNET_SUCCESS;
+          }
 
-        errno = 0;
-        ssize_t bytesSent = send(_owner->_fd, buffer.data(), buffer.size(), sendFlag);
+          case TransportBackend::IO_URING: {
+#ifdef RTELNET_WITH_IO_URING
+            if (io_uring_queue_init(RTELNET_URING_ENTRIES, &_ring, 0) < 0) return Errors::BACKEND_SETUP_FAILED;
+
+            int ringError = 0;
+            _bufRing = io_uring_setup_buf_ring(&_ring, RTELNET_URING_BUFFERS, RTELNET_URING_BUFFER_GROUP, 0, &ringError);
+            if (_bufRing == nullptr) {
+              io_uring_queue_exit(&_ring);
+              return Errors::BACKEND_SETUP_FAILED;
+            }
 
-        if (bytesSent == 0) return _owner->PUSH_ERROR(Errors::FAILED_SEND);
-        if (bytesSent < 0) return _owner->PUSH_ERROR(errno);
-        if (static_cast<size_t>(bytesSent) != buffer.size()) return _owner->PUSH_ERROR(Errors::PARTIAL_SEND);
+            _ringBufferSize = chunkSize(_owner->_transport.readChunk);
+            _ringStorage.assign(static_cast<size_t>(RTELNET_URING_BUFFERS) * _ringBufferSize, 0);
+            int mask = io_uring_buf_ring_mask(RTELNET_URING_BUFFERS);
+            for (int bid = 0; bid < RTELNET_URING_BUFFERS; ++bid) {
+              io_uring_buf_ring_add(_bufRing, _ringStorage.data() + static_cast<size_t>(bid) * _ringBufferSize, _ringBufferSize, bid, mask, bid);
+            }
+            io_uring_buf_ring_advance(_bufRing, RTELNET_URING_BUFFERS);
 
-        _owner->_logger.log(RTELNET_LOG_TCP_SEND, "Successfully sent message.", 4, LV(message), LV(sendFlag));
+            _pending.clear();
+            _pendingOffset = 0;
+            _recvArmed = false;
+            _peerClosed = false;
+            _ringReady = true;
 
-        return RTELNET_SUCCESS;
+            _owner->_logger.log(RTELNET_LOG_TCP_BACKEND, "Using io_uring backend.", 4, LV(RTELNET_URING_BUFFERS));
+            return RTELNET_SUCCESS;
+#else
+            (void)sockfd;
+            return Errors::BACKEND_NOT_AVAILABLE;
+#endif
+          }
+        }
+
+        return Errors::BACKEND_NOT_AVAILABLE;
       }
 
-      inline unsigned int Read(std::vector<unsigned char>& buffer, int readSize = RTELNET_BUFFER_SIZE, int recvFlag = 0) const {
-        if (!_owner->_connected) return _owner->PUSH_ERROR(Errors::NOT_CONNECTED);
+      inline void teardownBackend() {
+        if (_epfd >= 0) {
+          ::close(_epfd);
+          _epfd = -1;
+        }
+
+#ifdef RTELNET_WITH_IO_URING
+        if (_ringReady) {
+          io_uring_free_buf_ring(&_ring, _bufRing, RTELNET_URING_BUFFERS, RTELNET_URING_BUFFER_GROUP);
+          io_uring_queue_exit(&_ring);
+          _bufRing = nullptr;
+          _ringReady = false;
+        }
+#endif
+      }
 
+      // Shared by the readiness based backends, once the socket is known to be readable.
+      inline unsigned int receive(std::vector<unsigned char>& buffer, int readSize) {
         buffer.resize(readSize);
 
+        errno = 0;
+        ssize_t bytesRead = recv(_fd, reinterpret_cast<char*>(buffer.data()), readSize, 0);
+
+        if (bytesRead < 0) return errno;
+        if (bytesRead == 0) return Errors::CONNECTION_CLOSED_R;
+
+        if (quickAck()) setOption(_fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+
+        buffer.resize(bytesRead);
+ 
+        return RTELNET_SUCCESS;
+      }
+
+      inline unsigned int readSelect(std::vector<unsigned char>& buffer, int readSize, int waitMs) {
         fd_set readfds;
         FD_ZERO(&readfds);
-        FD_SET(_owner->_fd, &readfds);
+        FD_SET(_fd, &readfds);
 
         timeval timeout{};
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        timeout.tv_sec = waitMs / 1000;
+        timeout.tv_usec = (waitMs % 1000) * 1000;
 
-        int ready = select(_owner->_fd + 1, &readfds, nullptr, nullptr, &timeout);
-        if (ready < 0) return _owner->PUSH_ERROR(errno);
+        int ready = select(_fd + 1, &readfds, nullptr, nullptr, &timeout);
+        if (ready < 0) return errno;
         if (ready == 0) {
           buffer.clear();
           return RTELNET_SUCCESS;
         }
 
-        errno = 0;
-        ssize_t bytesRead = recv(_owner->_fd, reinterpret_cast<char*>(buffer.data()), readSize, recvFlag);
+        return receive(buffer, readSize);
+      }
+
+      inline unsigned int readEpoll(std::vector<unsigned char>& buffer, int readSize, int waitMs) {
+        epoll_event event{};
+        int ready = epoll_wait(_epfd, &event, 1, waitMs);
+        if (ready < 0) return errno;
+        if (ready == 0) {
+          buffer.clear();
+          return RTELNET_SUCCESS;
+        }
 
-        if (bytesRead < 0) return _owner->PUSH_ERROR(errno);
-        if (bytesRead == 0) return _owner->PUSH_ERROR(Errors::CONNECTION_CLOSED_R);
+        return receive(buffer, readSize);
+      }
+
+#ifdef RTELNET_WITH_IO_URING
+      // Arms the multishot recv if needed and reaps every completion that is ready,
+      // submission and wait happen in a single io_uring_enter().
+      inline unsigned int waitUring(int waitMs) {
+        if (!_recvArmed) {
+          io_uring_sqe* sqe = io_uring_get_sqe(&_ring);
+          if (sqe == nullptr) return Errors::BACKEND_SETUP_FAILED;
+
+          io_uring_prep_recv_multishot(sqe, _fd, nullptr, 0, 0);
+          sqe->flags |= IOSQE_BUFFER_SELECT;
+          sqe->buf_group = RTELNET_URING_BUFFER_GROUP;
+          io_uring_sqe_set_data64(sqe, _recvTag);
+          _recvArmed = true;
+        }
+
+        __kernel_timespec timeout{};
+        timeout.tv_sec = waitMs / 1000;
+        timeout.tv_nsec = (waitMs % 1000) * 1000000LL;
+
+        io_uring_cqe* cqe = nullptr;
+        int ret = io_uring_submit_and_wait_timeout(&_ring, &cqe, 1, &timeout, nullptr);
+        if (ret == -ETIME || ret == -EINTR) return RTELNET_SUCCESS;
+        if (ret < 0) return -ret;
+
+        unsigned int status = RTELNET_SUCCESS;
+        unsigned int head;
+        unsigned int seen = 0;
+        int recycled = 0;
+        int mask = io_uring_buf_ring_mask(RTELNET_URING_BUFFERS);
+
+        io_uring_for_each_cqe(&_ring, head, cqe) {
+          ++seen;
+          if (io_uring_cqe_get_data64(cqe) != _recvTag) continue;
+          if (!(cqe->flags & IORING_CQE_F_MORE)) _recvArmed = false;
+
+          if (cqe->res == -ENOBUFS) continue; // Ring drained, re armed on next wait.
+          if (cqe->res < 0) { status = -cqe->res; continue; }
+          if (cqe->res == 0) { _peerClosed = true; continue; }
+          if (!(cqe->flags & IORING_CQE_F_BUFFER)) continue;
+
+          unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+          unsigned char* chunk = _ringStorage.data() + static_cast<size_t>(bid) * _ringBufferSize;
+          _pending.insert(_pending.end(), chunk, chunk + cqe->res);
+
+          io_uring_buf_ring_add(_bufRing, chunk, _ringBufferSize, bid, mask, recycled++);
+        }
+
+        if (recycled > 0) io_uring_buf_ring_advance(_bufRing, recycled);
+        io_uring_cq_advance(&_ring, seen);
+
+        return status;
+      }
+#endif
+
+      inline unsigned int readUring(std::vector<unsigned char>& buffer, int readSize, int waitMs) {
+#ifdef RTELNET_WITH_IO_URING
+        if (_pendingOffset == _pending.size() && !_peerClosed) {
+          _pending.clear();
+          _pendingOffset = 0;
+
+          unsigned int waitStatus = waitUring(waitMs);
+          if (waitStatus != RTELNET_SUCCESS) return waitStatus;
+        }
+
+        size_t available = _pending.size() - _pendingOffset;
+        if (available == 0) {
+          buffer.clear();
+          if (_peerClosed) return Errors::CONNECTION_CLOSED_R;
+          return RTELNET_SUCCESS;
+        }
+
+        size_t toRead = std::min(static_cast<size_t>(readSize), available);
+        auto first = _pending.begin() + _pendingOffset;
+        buffer.assign(first, first + toRead);
+        _pendingOffset += toRead;
+
+        return RTELNET_SUCCESS;
+#else
+        (void)buffer; (void)readSize; (void)waitMs;
+        return Errors::BACKEND_NOT_AVAILABLE;
+#endif
+      }
+    };
+
+    // Session side of the connection: the one streamTransport it runs over (the
+    // caller's _stream, or a tcpTransport), error reporting and telnet escaping.
+    class tcp {
+    public:
+      tcp(session* owner) : _owner(owner) {}
+
+      inline unsigned int Connect() {
+        if (_owner->_stream) _link = _owner->_stream;
+        else _link = std::make_shared<tcpTransport>(_owner);
+
+        unsigned int status = _link->connect(_owner->_address, _owner->_port);
+        if (status != RTELNET_SUCCESS) {
+          _link.reset();
+          return _owner->PUSH_ERROR(status);
+        }
+
+        _owner->_connected = true;
+        return RTELNET_SUCCESS;
+      }
+
+      void Close() {
+        if (_link) _link->close();
+        _owner->_logger.log(RTELNET_LOG_TCP_CLOSE, "Closed socket.", 4);
+        _owner->_connected = false;
+        _owner->_admissionTicket.release();
+      }
+
+      // Wakes the reader out of its wait, it then sees the connection as closed.
+      inline void Interrupt() const {
+        if (_link) _link->interrupt();
+      }
+
+      inline unsigned int SendBin(const std::vector<unsigned char>& message) const {
+        if (!_owner->_connected) return _owner->PUSH_ERROR(Errors::NOT_CONNECTED);
+
+        unsigned int sendStatus = _link->write(message.data(), message.size());
+        if (sendStatus != RTELNET_SUCCESS) return _owner->PUSH_ERROR(sendStatus);
+
+        _owner->_logger.log(RTELNET_LOG_TCP_SEND_BIN, "Successfully sent message.", 4, LV(message));
+
+        return RTELNET_SUCCESS;
+      }
+
+      inline unsigned int Send(const std::string& message) const {
+        if (!_owner->_connected) return _owner->PUSH_ERROR(Errors::NOT_CONNECTED);
+
+        std::vector<unsigned char> buffer;
+        buffer.reserve(message.size());
+
+        // Escape 255/0xFF unless full duplex binary communication.
+        for (unsigned char c : message) {
+          buffer.push_back(c);
+          if (!(_owner->_binarySendEnabled && _owner->_binaryReceiveEnabled) && c == 255) buffer.push_back(255);
+        }
+
+        unsigned int sendStatus = _link->write(buffer.data(), buffer.size());
+        if (sendStatus != RTELNET_SUCCESS) return _owner->PUSH_ERROR(sendStatus);
+
+        _owner->_logger.log(RTELNET_LOG_TCP_SEND, "Successfully sent message.", 4, LV(message));
 
-        buffer.resize(bytesRead);
- 
         return RTELNET_SUCCESS;
       }
 
+      // Waits up to RTELNET_READ_WAIT, an empty buffer means nothing arrived.
+      inline unsigned int Read(std::vector<unsigned char>& buffer, int readSize = RTELNET_BUFFER_SIZE) {
+        if (!_owner->_connected) return _owner->PUSH_ERROR(Errors::NOT_CONNECTED);
+
+        unsigned int status = _link->read(buffer, static_cast<size_t>(chunkSize(readSize)), RTELNET_READ_WAIT);
+        return (status == RTELNET_SUCCESS) ? status : _owner->PUSH_ERROR(status);
+      }
+
+      inline void endHandshake() const {
+        if (_link) _link->endHandshake();
+      }
+
     private:
       session* _owner;
+      std::shared_ptr<streamTransport> _link; // Set by Connect(), kept until the next one
     };
 
     // Read-only accessors
@@ -541,137 +1103,493 @@ namespace rtnt {
     inline bool isNegotiated() const { return _negotiated; }
     inline bool isLoggedIn() const { return _logged_in; }
     inline int getBackgroundError() const { return _backgroundError; }
+    inline const sessionMetrics& getMetrics() const { return _metrics; }
+    inline bool isCompressing() const { return _compressing; }
     inline bool isBackgroundError() const { return _stopBackground; }
+    inline bool isAlive() const { return _connected && !_dead; }
+
+    // Answers `pattern` with `response` from the reader, the moment the pattern
+    // arrives, instead of waiting for the command to go idle. Rules stay until
+    // cleared, an exhausted rule is kept for its count. Only output after the login
+    // is looked at.
+    inline void AutoRespond(const std::string& pattern, const std::string& response, int maxFires = 1) {
+      if (pattern.empty()) return;
+      std::lock_guard<std::mutex> lock(_responderMutex);
+      _responders.push_back({pattern, response, maxFires, 0});
+      _responderWindow = std::max(_responderWindow, pattern.size());
+      _respondersArmed = true;
+    }
+
+    inline void ClearAutoResponses() {
+      std::lock_guard<std::mutex> lock(_responderMutex);
+      _responders.clear();
+      _responderTail.clear();
+      _responderWindow = 0;
+      _respondersArmed = false;
+    }
+
+    // Copy of the rules with their fire counts.
+    inline std::vector<autoResponse> getAutoResponses() const {
+      std::lock_guard<std::mutex> lock(_responderMutex);
+      return _responders;
+    }
 
     tcp _tcp;
     Logger _logger;
 
     inline unsigned int Read(std::vector<unsigned char>& buffer, size_t n = RTELNET_BUFFER_SIZE, unsigned int flag = 0, unsigned int timeoutMs = 1000) {
-      auto start = std::chrono::steady_clock::now();
-
-      while (true) {
-        {
-          std::lock_guard<std::mutex> lock(_bufferMutex);
+      std::atomic<bool> expired{false};
+      scopedTimer deadline(timerWheel::shared(), std::chrono::milliseconds(timeoutMs), wakeOn(expired));
 
-          size_t toRead = std::min(n, _sharedBuffer.size());
+      std::unique_lock<std::mutex> lock(_bufferMutex);
 
-          if (toRead > 0) {
-            buffer.insert(buffer.end(), _sharedBuffer.begin(), _sharedBuffer.begin() + toRead);
-            if (flag != MSG_PEEK) {
-                _sharedBuffer.erase(_sharedBuffer.begin(), _sharedBuffer.begin() + toRead);
-            }
-            return RTELNET_SUCCESS;
-          }
-        }
+      // Woken by the reader as soon as data lands, or by the deadline.
+      _bufferCv.wait(lock, [this, &expired]() {
+        return !_sharedBuffer.empty() || _stopBackground || expired;
+      });
 
-        auto now = std::chrono::steady_clock::now();
-        if (std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count() > timeoutMs) {
-          buffer.clear();
-          return RTELNET_SUCCESS;
-        }
+      size_t toRead = std::min(n, _sharedBuffer.size());
+      if (toRead == 0) {
+        buffer.clear();
+        return RTELNET_SUCCESS;
+      }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(10)); // avoid CPU spinning
+      buffer.insert(buffer.end(), _sharedBuffer.begin(), _sharedBuffer.begin() + toRead);
+      if (flag != MSG_PEEK) {
+          _sharedBuffer.erase(_sharedBuffer.begin(), _sharedBuffer.begin() + toRead);
       }
+      return RTELNET_SUCCESS;
     }
 
     inline unsigned int Connect() {
 
       _logger.log(RTELNET_LOG_CONNECT, "Trying to connnected to telnet server.", 2, LV(_address), LV(_port));
 
-      // Get address
-      sockaddr_in address;
-      unsigned int addressResult = _tcp.setSocketAddr(address);
-      if (addressResult != 0 ) return PUSH_ERROR(addressResult);
+      if (_admission) {
+        if (_admission->weak_from_this().expired()) return PUSH_ERROR(Errors::ADMISSION_NOT_SHARED);
+
+        double waited = 0;
+        bool admitted = _admission->acquire(_address, _admissionTicket, waited);
+        _metrics.admissionWaitMs = static_cast<int>(waited);
+        if (!admitted) return PUSH_ERROR(Errors::ADMISSION_TIMEOUT);
+        if (waited >= 1) _logger.log(RTELNET_LOG_CONNECT, "Admitted after queueing.", 2, LV(_address), LV(waited));
+      }
+
+      unsigned int connectStatus = _tcp.Connect();
+      if (connectStatus != RTELNET_SUCCESS) {
+        _admissionTicket.release();
+        return PUSH_ERROR(connectStatus);
+      }
+      auto connected = std::chrono::steady_clock::now();
+
+      unsigned int earlyStatus = AnswerEarly();
+      if (earlyStatus != RTELNET_SUCCESS) return abortConnect(earlyStatus);
+
+      _lastReceive = std::chrono::steady_clock::now();
+      _lastHeartbeat = _lastReceive;
+      _heartbeatPending = false;
+      _aytReplyPending = false;
+      {
+        std::lock_guard<std::mutex> lock(_responderMutex);
+        _responderTail.clear();
+      }
 
-      int fd = _tcp.Connect(address);
-      if (fd < 0) return PUSH_ERROR(fd);
-      _fd = fd;
-      
       _background = std::thread([this]() {
-        while (!_stopBackground) {
-          int readFlag = 0;
-          if (!_negotiated) readFlag = MSG_PEEK;
+        std::vector<unsigned char> buffer;
 
-          std::vector<unsigned char> buffer;
-          unsigned int status = _tcp.Read(buffer, RTELNET_BUFFER_SIZE, readFlag);
+        while (!_stopBackground) {
+          buffer.clear();
+          unsigned int status = _tcp.Read(buffer, _transport.readChunk);
 
           if (status != RTELNET_SUCCESS) {
-            _stopBackground = true; _backgroundError = status; break;
+            markDead(status);
+            break;
           }
 
-          if (buffer[0] == TelnetCommands::IAC) {
-            int negotiateStatus = Negotiate();
-            if (negotiateStatus != RTELNET_SUCCESS) {
-              _stopBackground = true;
-              _backgroundError = negotiateStatus;
+          // The transport wait already blocked for up to RTELNET_READ_WAIT.
+          if (buffer.empty()) {
+            unsigned int heartbeatStatus = Heartbeat();
+            if (heartbeatStatus != RTELNET_SUCCESS) {
+              markDead(heartbeatStatus);
               break;
             }
             continue;
-          } else {
-            std::lock_guard<std::mutex> lock(_bufferMutex);
-            _sharedBuffer.insert(_sharedBuffer.end(), buffer.begin(), buffer.end());
           }
 
-          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          _lastReceive = std::chrono::steady_clock::now();
+          _heartbeatPending = false;
+
+          unsigned int processStatus = ProcessIncoming(buffer.data(), buffer.size());
+          if (processStatus != RTELNET_SUCCESS) {
+            markDead(processStatus);
+            break;
+          }
         }
+
+        _bufferCv.notify_all();
       });
 
+      {
+        std::atomic<bool> expired{false};
+        scopedTimer deadline(timerWheel::shared(), std::chrono::seconds(RTELNET_NEGOTIATION_TIMEOUT), wakeOn(expired));
 
-      auto start = std::chrono::steady_clock::now();
-      while (!_negotiated) {
-        if ((std::chrono::steady_clock::now() - start) > std::chrono::seconds(RTELNET_NEGOTIATION_TIMEOUT)) {
-          return PUSH_ERROR(Errors::NEGOTIATION_TIMEOUT);
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::unique_lock<std::mutex> lock(_bufferMutex);
+        _bufferCv.wait(lock, [this, &expired]() { return _negotiated || _stopBackground || expired; });
       }
+      if (!_negotiated) return abortConnect(Errors::NEGOTIATION_TIMEOUT);
 
       int loginStatus = Login();
-      if (loginStatus != RTELNET_SUCCESS) return PUSH_ERROR(loginStatus);
+      if (loginStatus != RTELNET_SUCCESS) return abortConnect(loginStatus);
+
+      _metrics.handshakeMs = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - connected).count());
+
+      if (_negotiationProfiles) {
+        optionRequests observed;
+        {
+          std::lock_guard<std::mutex> lock(_bufferMutex);
+          observed = _observedRequests;
+        }
+        _negotiationProfiles->store(_address, _port, std::move(observed));
+      }
 
       _logger.log(RTELNET_LOG_CONNECT, "Connected to telnet server.", 2, _address, _port);
  
       return RTELNET_SUCCESS;
     }
 
-    unsigned int Execute(const std::string& command, std::string& buffer) {
-      if (!_connected) return PUSH_ERROR(Errors::NOT_CONNECTED);
-      if (!_negotiated) return PUSH_ERROR(Errors::NOT_NEGOTIATED);
-      if (!_logged_in) return PUSH_ERROR(Errors::NOT_LOGGED);
-
-      _logger.log(RTELNET_LOG_EXECUTE, "Trying to execute a command.", 2, LV(command));
-
-      unsigned int sendStatus = _tcp.Send(command + "\n");
-      if (sendStatus != RTELNET_SUCCESS) return PUSH_ERROR(sendStatus);
-
-      std::vector<unsigned char> output;
-      buffer.clear();
+    // Drops the current connection and runs Connect() again, safe to call from _reconnectCallback.
+    // Waits for the command in progress (a dead reader has already woken it), the
+    // session stays dead until Connect() succeeds.
+    unsigned int Reconnect() {
+      if (_closing) return PUSH_ERROR(Errors::NOT_CONNECTED);
 
-      auto startTime = std::chrono::steady_clock::now();
-      auto lastRead = startTime;
+      std::lock_guard<std::mutex> executeLock(_executeMutex);
 
-      while (true) {
-        output.clear();
+      _logger.log(RTELNET_LOG_RECONNECT, "Reconnecting.", 1, LV(_address), LV(_port));
 
-        unsigned int readStatus = Read(output);
-        if (readStatus != RTELNET_SUCCESS) return readStatus;
+      {
+        std::lock_guard<std::mutex> lock(_bufferMutex);
+        _stopBackground = true;
+        _dead = true;
+      }
+      if (_background.joinable() && _background.get_id() != std::this_thread::get_id()) {
+        _tcp.Interrupt();
+        _background.join();
+      }
 
-        if (!output.empty()) {
-          buffer.append(reinterpret_cast<const char*>(output.data()), output.size());
-          lastRead = std::chrono::steady_clock::now();
-        }
+      endCompression();
+      _tcp.Close();
 
-        auto now = std::chrono::steady_clock::now();
-        auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastRead).count();
-        auto total = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime).count();
+      {
+        std::lock_guard<std::mutex> lock(_bufferMutex);
+        _sharedBuffer.clear();
+      }
+      _negotiated = false;
+      _logged_in = false;
+      _binarySendEnabled = false;
+      _binaryReceiveEnabled = false;
+      _parserState = parserState::DATA;
+      _sbPayload.clear();
+      _backgroundError = RTELNET_SUCCESS;
+      _stopBackground = false;
+      ++_metrics.reconnects;
+
+      if (_closing) return PUSH_ERROR(Errors::NOT_CONNECTED);
+      unsigned int status = Connect();
+      if (status != RTELNET_SUCCESS) return status;
+
+      // Unless the new reader died already, markDead() has then queued another round.
+      std::lock_guard<std::mutex> lock(_bufferMutex);
+      if (!_stopBackground) _dead = false;
+      return _dead ? PUSH_ERROR(Errors::SESSION_DEAD) : RTELNET_SUCCESS;
+    }
 
-        if (idle > _idle || total > _timeout) break;
+    // Queues a command from any thread, commands run in submission order on this
+    // connection and each future carries its own output.
+    std::future<commandResult> Submit(const std::string& command) {
+      pendingCommand pending;
+      pending.command = command;
+      std::future<commandResult> future = pending.promise.get_future();
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      if (_closing) {
+        pending.promise.set_value(commandResult{Errors::NOT_CONNECTED, ""});
+        return future;
       }
 
-      _logger.log(RTELNET_LOG_EXECUTE, "Executed command successfully.", 2, LV(command));
+      startDispatcher();
+      _commands.push(std::move(pending));
+      ++_metrics.commandsSubmitted;
 
-      return RTELNET_SUCCESS;
+      { std::lock_guard<std::mutex> lock(_queueMutex); }
+      _queueCv.notify_one();
+
+      _logger.log(RTELNET_LOG_QUEUE, "Queued command.", 3, LV(command), LV(_commands.size()));
+      return future;
+    }
+
+    unsigned int Execute(const std::string& command, std::string& buffer) {
+      if (_cache) {
+        std::chrono::milliseconds ttl = _cache->ttlFor(command);
+        if (ttl.count() > 0) {
+          std::string key = commandCache::makeKey(_address, _port, _username, command);
+          bool ranHere = false;
+          unsigned int status = _cache->fetch(key, ttl, [this, &command, &ranHere](std::string& output) {
+            ranHere = true;
+            return ExecuteOnWire(command, output);
+          }, buffer);
+
+          // ExecuteOnWire() already recorded its own failure, a joined request records the shared one.
+          if (status != RTELNET_SUCCESS && !ranHere) return PUSH_ERROR(status);
+          return status;
+        }
+      }
+
+      return ExecuteOnWire(command, buffer);
+    }
+
+    // Execute() handing the output over chunk by chunk as it arrives, a non zero
+    // return from `sink` stops the delivery and becomes the status.
+    unsigned int Stream(const std::string& command, const std::function<int(const char*, size_t)>& sink) {
+      return Collect(command, sink);
+    }
+
+    // Execute() parsing the output into rows with a compiled template, line by line
+    // as it arrives. Cached commands are parsed from the cached output.
+    unsigned int Execute(const std::string& command, const textTemplate& compiled, templateResult& result) {
+      templateParser parser(compiled);
+
+      if (_cache && _cache->ttlFor(command).count() > 0) {
+        std::string output;
+        unsigned int status = Execute(command, output);
+        if (status != RTELNET_SUCCESS) return PUSH_ERROR(status);
+        parser.feed(output);
+      } else {
+        // The whole output is read even after an Error rule, the next command starts clean.
+        unsigned int status = Collect(command, [&parser](const char* data, size_t size) {
+          parser.feed(std::string_view(data, size));
+          return 0;
+        });
+        if (status != RTELNET_SUCCESS) return PUSH_ERROR(status);
+      }
+
+      bool parsed = parser.finish();
+      result = parser.take();
+      return parsed ? RTELNET_SUCCESS : PUSH_ERROR(Errors::TEMPLATE_FAILED);
+    }
+
+    // Sends a command and collects its output until `expected` shows up, for commands
+    // that stay quiet for longer than the idle timeout (copy, reload, ...).
+    unsigned int Expect(const std::string& command, const std::string& expected, std::string& buffer,
+                        int timeoutMs = RTELNET_EXPECT_TIMEOUT) {
+      std::lock_guard<std::mutex> executeLock(_executeMutex);
+
+      if (_dead) return PUSH_ERROR(Errors::SESSION_DEAD);
+      if (!_connected) return PUSH_ERROR(Errors::NOT_CONNECTED);
+      if (!_negotiated) return PUSH_ERROR(Errors::NOT_NEGOTIATED);
+      if (!_logged_in) return PUSH_ERROR(Errors::NOT_LOGGED);
+
+      _logger.log(RTELNET_LOG_EXECUTE, "Trying to execute a command.", 2, LV(command), LV(expected));
+
+      unsigned int sendStatus = _tcp.Send(command + "\n");
+      if (sendStatus != RTELNET_SUCCESS) return PUSH_ERROR(sendStatus);
+
+      buffer.clear();
+
+      std::atomic<bool> expired{false};
+      scopedTimer deadline(timerWheel::shared(), std::chrono::milliseconds(timeoutMs), wakeOn(expired));
+
+      std::vector<unsigned char> chunk;
+      const size_t overlap = expected.empty() ? 0 : expected.size() - 1;
+
+      while (true) {
+        std::unique_lock<std::mutex> lock(_bufferMutex);
+        _bufferCv.wait(lock, [&]() { return !_sharedBuffer.empty() || expired || _stopBackground; });
+
+        if (_sharedBuffer.empty()) break;
+
+        chunk.clear();
+        chunk.swap(_sharedBuffer);
+        lock.unlock();
+
+        // Only the new bytes, plus enough of the old ones for a match across chunks.
+        size_t from = (buffer.size() > overlap) ? buffer.size() - overlap : 0;
+        buffer.append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+        if (buffer.find(expected, from) != std::string::npos) return RTELNET_SUCCESS;
+      }
+
+      return PUSH_ERROR(Errors::CANT_FIND_EXPECTED);
+    }
+
+    // Streams configuration lines in a sliding window. New lines are only sent as
+    // older ones get acknowledged (echoed, or answered with `options.prompt`), so
+    // the device sets the pace and its input buffer is never overrun. Each line's
+    // output is checked against `options.errorPatterns`.
+    unsigned int Push(const std::vector<std::string>& lines, pushReport& report, const pushOptions& options = pushOptions()) {
+      std::lock_guard<std::mutex> executeLock(_executeMutex);
+
+      if (_dead) return PUSH_ERROR(Errors::SESSION_DEAD);
+      if (!_connected) return PUSH_ERROR(Errors::NOT_CONNECTED);
+      if (!_negotiated) return PUSH_ERROR(Errors::NOT_NEGOTIATED);
+      if (!_logged_in) return PUSH_ERROR(Errors::NOT_LOGGED);
+
+      size_t total = lines.size();
+      _logger.log(RTELNET_LOG_PUSH, "Pushing lines.", 2, LV(total));
+
+      // Left over output (a prompt above all) would acknowledge line 0 and shift every error by one.
+      {
+        std::lock_guard<std::mutex> lock(_bufferMutex);
+        _sharedBuffer.clear();
+      }
+
+      report = pushReport();
+      const bool onEcho = options.prompt.empty();
+      const size_t window = std::max<size_t>(options.window, 1);
+      size_t next = 0;
+      size_t inflightBytes = 0;
+      bool stopping = false;
+      std::string pending; // Received but not matched yet
+      std::vector<unsigned char> chunk;
+
+      auto checkResponse = [&](size_t line, std::string_view response) {
+        for (const std::string& pattern : options.errorPatterns) {
+          if (pattern.empty() || response.find(pattern) == std::string_view::npos) continue;
+          report.errors.push_back(pushLineError{line, lines[line], std::string(response)});
+          if (options.stopOnError) stopping = true;
+          return;
+        }
+      };
+
+      std::atomic<bool> idleExpired{false};
+      scopedTimer idle(timerWheel::shared(), std::chrono::milliseconds(options.lineTimeout), wakeOn(idleExpired));
+
+      while (true) {
+        // Fill the window, a single line always fits. Sent as one write.
+        std::string batch;
+        while (!stopping && next < lines.size() && next - report.acknowledged < window &&
+               (next == report.acknowledged || inflightBytes + lines[next].size() + 1 <= options.windowBytes)) {
+          batch.append(lines[next]).push_back('\n');
+          inflightBytes += lines[next].size() + 1;
+          ++next;
+        }
+
+        if (!batch.empty()) {
+          unsigned int sendStatus = _tcp.Send(batch);
+          if (sendStatus != RTELNET_SUCCESS) return PUSH_ERROR(sendStatus);
+          report.sent = next;
+        }
+
+        if (report.acknowledged == next) break;
+
+        std::unique_lock<std::mutex> lock(_bufferMutex);
+        _bufferCv.wait(lock, [&]() { return !_sharedBuffer.empty() || idleExpired || _stopBackground; });
+
+        if (_sharedBuffer.empty()) {
+          return PUSH_ERROR(idleExpired ? Errors::PUSH_TIMEOUT : Errors::CONNECTION_CLOSED_R);
+        }
+
+        chunk.clear();
+        chunk.swap(_sharedBuffer);
+        lock.unlock();
+
+        pending.append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+
+        idle.cancel();
+        idleExpired = false;
+        idle.reset(std::chrono::milliseconds(options.lineTimeout));
+
+        size_t consumed = 0;
+        while (report.acknowledged < next) {
+          size_t line = report.acknowledged;
+
+          if (onEcho) {
+            size_t found = pending.find(lines[line], consumed);
+            if (found == std::string::npos) break;
+            size_t end = pending.find('\n', found + lines[line].size());
+            if (end == std::string::npos) break;
+
+            // Whatever came between two echoes is the previous line's output.
+            if (line > 0) checkResponse(line - 1, std::string_view(pending).substr(consumed, found - consumed));
+            consumed = end + 1;
+          } else {
+            size_t found = pending.find(options.prompt, consumed);
+            if (found == std::string::npos) break;
+
+            checkResponse(line, std::string_view(pending).substr(consumed, found - consumed));
+            consumed = found + options.prompt.size();
+          }
+
+          inflightBytes -= lines[line].size() + 1;
+          ++report.acknowledged;
+        }
+        pending.erase(0, consumed);
+      }
+
+      idle.cancel();
+
+      // On echoes the last line's output has no closing echo, collect it until the device goes quiet.
+      if (onEcho && report.acknowledged > 0) {
+        std::atomic<bool> quiet{false};
+        scopedTimer settle(timerWheel::shared(), std::chrono::milliseconds(_idle), wakeOn(quiet));
+
+        while (true) {
+          std::unique_lock<std::mutex> lock(_bufferMutex);
+          _bufferCv.wait(lock, [&]() { return !_sharedBuffer.empty() || quiet || _stopBackground; });
+
+          if (_sharedBuffer.empty()) break;
+
+          pending.append(reinterpret_cast<const char*>(_sharedBuffer.data()), _sharedBuffer.size());
+          _sharedBuffer.clear();
+          lock.unlock();
+
+          settle.cancel();
+          quiet = false;
+          settle.reset(std::chrono::milliseconds(_idle));
+        }
+
+        checkResponse(report.acknowledged - 1, pending);
+      }
+
+      size_t failed = report.errors.size();
+      _logger.log(RTELNET_LOG_PUSH, "Pushed lines.", 2, LV(report.acknowledged), LV(failed));
+
+      if (failed > 0) return PUSH_ERROR(Errors::PUSH_LINE_FAILED);
+
+      return RTELNET_SUCCESS;
+    }
+
+    // Push() for a configuration file, one line per line.
+    unsigned int PushFile(const std::string& path, pushReport& report, const pushOptions& options = pushOptions()) {
+      errno = 0; // Not every ifstream failure sets it
+      std::ifstream file(path);
+      if (!file) return PUSH_ERROR(errno ? errno : EIO);
+
+      std::vector<std::string> lines;
+      std::string line;
+      while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        lines.push_back(std::move(line));
+      }
+
+      return Push(lines, report, options);
+    }
+
+    // Execute() for very large outputs, past its threshold `output` spills to a
+    // memory mapped temp file. Never served from the cache.
+    unsigned int Execute(const std::string& command, spillBuffer& output) {
+      output.clear();
+
+      unsigned int status = Collect(command, [&output](const char* data, size_t size) {
+        return output.append(data, size);
+      });
+      if (status != RTELNET_SUCCESS) return status;
+
+      int finished = output.finish();
+      if (finished != 0) return PUSH_ERROR(finished);
+
+      if (output.spilled()) _logger.log(RTELNET_LOG_EXECUTE, "Output spilled to disk.", 2, LV(command));
+
+      return RTELNET_SUCCESS;
     }
 
     inline unsigned int FlushBanner() {
@@ -687,23 +1605,57 @@ namespace rtnt {
     }
 
   private:
-    bool _connected = false;
-    bool _negotiated = false;
-    bool _logged_in = false;
-    int _fd;
+    std::atomic<bool> _connected{false};
+    std::atomic<bool> _negotiated{false};
+    std::atomic<bool> _logged_in{false};
+    admissionTicket _admissionTicket; // Held while connected, see _admission
 
     /*        ---           IAC Listener         ---         */
     std::thread _background;
     std::atomic<bool> _stopBackground{false};
     std::mutex _bufferMutex;
+    std::condition_variable _bufferCv;
     std::vector<unsigned char> _sharedBuffer;
-    unsigned int _backgroundError;
-
+    unsigned int _backgroundError = RTELNET_SUCCESS;
+    std::atomic<bool> _dead{false};
+    std::atomic<bool> _closing{false};
+
+    // Heartbeat state, only touched by the reader.
+    std::chrono::steady_clock::time_point _lastReceive;
+    std::chrono::steady_clock::time_point _lastHeartbeat;
+    bool _heartbeatPending = false;
+    bool _aytReplyPending = false; // Until the AYT answer has been taken out of the data
+
+    std::mutex _reconnectMutex;
+    std::thread _reconnector;
+    std::atomic<bool> _reconnecting{false};
+    std::atomic<bool> _reconnectPending{false}; // Died while the callback was running
+
+    sessionMetrics _metrics;
+
+    enum class parserState { DATA, IAC_SEEN, OPTION, SB_OPTION, SB_DATA, SB_IAC };
+    parserState _parserState = parserState::DATA;
+    unsigned char _parserCommand = 0;
+    unsigned char _sbOption = 0;
+    std::vector<unsigned char> _sbPayload;
+    std::vector<unsigned char> _pendingAnswers; // Queued by Negotiate() and Respond(), sent once per chunk
+    optionRequests _earlyAccepted;              // Agreed to before the server asked
+    optionRequests _observedRequests;           // DO/WILL seen this connection, guarded by _bufferMutex
+
+    mutable std::mutex _responderMutex;
+    std::vector<autoResponse> _responders;
+    std::string _responderTail;                 // Last bytes of the output, a pattern may straddle two chunks
+    size_t _responderWindow = 0;                // Longest pattern
+    std::atomic<bool> _respondersArmed{false};  // Any rule, checked by the reader without the lock
     /*        ---           IAC Listener         ---         */
 
     /*        ---         Telnet commands        ---         */
     bool _binarySendEnabled = false;
     bool _binaryReceiveEnabled = false; 
+    std::atomic<bool> _compressing{false};
+#ifdef RTELNET_WITH_ZLIB
+    z_stream _zstream{};
+#endif
     /*        ---         Telnet commands        ---         */
 
     struct errorEntry {
@@ -713,6 +1665,186 @@ namespace rtnt {
     };
 
     std::vector<errorEntry> errorStack;
+    std::mutex _errorMutex;
+
+    /*        ---          Command queue         ---         */
+    struct pendingCommand {
+      std::string command;
+      std::promise<commandResult> promise;
+    };
+
+    std::mutex _executeMutex; // One command owns the shared buffer at a time
+    bool _cutByAdaptiveIdle = false; // Last command ended on a learned cutoff (under _executeMutex)
+    bool _echoSeen = false;          // Replies start with the command's echo (under _executeMutex)
+    mpscQueue<pendingCommand> _commands;
+    std::mutex _queueMutex;   // Only used to sleep, enqueue is lock free
+    std::condition_variable _queueCv;
+    std::thread _dispatcher;
+    std::once_flag _dispatcherOnce;
+    std::atomic<bool> _stopDispatcher{false};
+
+    inline void startDispatcher() {
+      std::call_once(_dispatcherOnce, [this]() {
+        _dispatcher = std::thread([this]() { dispatch(); });
+      });
+    }
+
+    inline void stopDispatcher() {
+      {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        _stopDispatcher = true;
+      }
+      _queueCv.notify_all();
+
+      // Synchronizes with a Submit() racing the destructor.
+      std::call_once(_dispatcherOnce, []() {});
+      if (_dispatcher.joinable()) _dispatcher.join();
+    }
+
+    // Single consumer: runs queued commands back to back on this connection.
+    void dispatch() {
+      pendingCommand pending;
+
+      while (true) {
+        // Checked before each command, the one running when the session closes is the last sent.
+        if (_stopDispatcher) break;
+
+        if (_commands.pop(pending)) {
+          commandResult result;
+          result.status = Execute(pending.command, result.output);
+          ++_metrics.commandsCompleted;
+          pending.promise.set_value(std::move(result));
+          continue;
+        }
+
+        // A producer between push() and linking its node, it is done within a few instructions.
+        if (_commands.size() > 0) {
+          std::this_thread::yield();
+          continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_queueMutex);
+        if (_stopDispatcher) break;
+        _queueCv.wait(lock, [this]() { return _commands.size() > 0 || _stopDispatcher; });
+        if (_stopDispatcher) break;
+      }
+
+      // Session is going away, fail whatever is left instead of running it. size()
+      // also counts a command whose producer has not linked it yet, pop() gets it next.
+      while (_commands.size() > 0) {
+        if (!_commands.pop(pending)) {
+          std::this_thread::yield();
+          continue;
+        }
+        pending.promise.set_value(commandResult{Errors::NOT_CONNECTED, ""});
+      }
+    }
+    /*        ---          Command queue         ---         */
+
+    // Execute() without the cache.
+    unsigned int ExecuteOnWire(const std::string& command, std::string& buffer) {
+      buffer.clear();
+      return Collect(command, [&buffer](const char* data, size_t size) {
+        buffer.append(data, size);
+        return 0;
+      });
+    }
+
+    // Sends a command and hands its output to `sink` chunk by chunk, owns the shared
+    // buffer for the whole command. Chunks are taken out of the shared buffer first,
+    // the reader is never blocked on the sink. A failing sink stops receiving but the
+    // output is still drained so the next command starts clean.
+    unsigned int Collect(const std::string& command, const std::function<int(const char*, size_t)>& sink) {
+      std::lock_guard<std::mutex> executeLock(_executeMutex);
+
+      if (_dead) return PUSH_ERROR(Errors::SESSION_DEAD);
+      if (!_connected) return PUSH_ERROR(Errors::NOT_CONNECTED);
+      if (!_negotiated) return PUSH_ERROR(Errors::NOT_NEGOTIATED);
+      if (!_logged_in) return PUSH_ERROR(Errors::NOT_LOGGED);
+
+      _logger.log(RTELNET_LOG_EXECUTE, "Trying to execute a command.", 2, LV(command));
+
+      std::shared_ptr<idleProfile> profile = _idleProfiles ? _idleProfiles->profileFor(_address, _port) : nullptr;
+
+      // Output of the previous command showing up now means its cutoff was too short.
+      auto lateOutput = [&]() {
+        profile->penalize();
+        ++_metrics.lateOutputs;
+        _logger.log(RTELNET_LOG_EXECUTE, "Output arrived after the idle cutoff, widening it.", 2, LV(_address));
+      };
+
+      if (profile && _cutByAdaptiveIdle) {
+        bool waiting = false;
+        {
+          std::lock_guard<std::mutex> lock(_bufferMutex);
+          waiting = !_sharedBuffer.empty();
+        }
+        if (waiting) lateOutput();
+      }
+
+      const int firstIdle = profile ? profile->firstByteCutoff(_idle, _idleProfiles->options()) : _idle;
+      const int gapIdle = profile ? profile->gapCutoff(_idle, _idleProfiles->options()) : _idle;
+      _metrics.idleCutoff = gapIdle;
+
+      unsigned int sendStatus = _tcp.Send(command + "\n");
+      if (sendStatus != RTELNET_SUCCESS) return PUSH_ERROR(sendStatus);
+
+      // Both deadlines live on the shared wheel, nothing wakes this thread but data or expiry.
+      std::atomic<bool> idleExpired{false};
+      std::atomic<bool> totalExpired{false};
+      scopedTimer total(timerWheel::shared(), std::chrono::milliseconds(_timeout), wakeOn(totalExpired));
+      scopedTimer idle(timerWheel::shared(), std::chrono::milliseconds(firstIdle), wakeOn(idleExpired));
+
+      std::vector<unsigned char> chunk;
+      int sinkStatus = 0;
+
+      const auto sent = std::chrono::steady_clock::now();
+      auto lastChunk = sent;
+      double firstByteMs = 0, maxGapMs = 0;
+      size_t chunks = 0;
+
+      while (true) {
+        std::unique_lock<std::mutex> lock(_bufferMutex);
+        _bufferCv.wait(lock, [&]() {
+          return !_sharedBuffer.empty() || idleExpired || totalExpired || _stopBackground;
+        });
+
+        if (_sharedBuffer.empty()) break;
+
+        chunk.clear();
+        chunk.swap(_sharedBuffer);
+        lock.unlock();
+
+        auto now = std::chrono::steady_clock::now();
+        double elapsedMs = std::chrono::duration<double, std::milli>(now - lastChunk).count();
+        if (chunks++ == 0) {
+          firstByteMs = elapsedMs;
+          if (profile) checkEcho(command, chunk, lateOutput);
+        } else {
+          maxGapMs = std::max(maxGapMs, elapsedMs);
+        }
+        lastChunk = now;
+
+        if (sinkStatus == 0) sinkStatus = sink(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+
+        if (totalExpired) break;
+
+        // Cancel before clearing the flag, a concurrent expiry is then either cancelled or already seen.
+        idle.cancel();
+        idleExpired = false;
+        idle.reset(std::chrono::milliseconds(gapIdle));
+      }
+
+      // Only commands that ended on the idle cutoff say something about the device.
+      _cutByAdaptiveIdle = profile && !totalExpired && !_stopBackground;
+      if (_cutByAdaptiveIdle && chunks > 0) profile->record(firstByteMs, maxGapMs);
+
+      if (sinkStatus != 0) return PUSH_ERROR(sinkStatus);
+
+      _logger.log(RTELNET_LOG_EXECUTE, "Executed command successfully.", 2, LV(command));
+
+      return RTELNET_SUCCESS;
+    }
 
     unsigned int pushError(unsigned int code, unsigned int line, const std::string& function) {
       errorEntry ee;
@@ -720,190 +1852,612 @@ namespace rtnt {
       ee.line = line;
       ee.function = function;
 
+      std::lock_guard<std::mutex> lock(_errorMutex);
+      if (errorStack.size() >= RTELNET_ERROR_STACK_MAX) errorStack.erase(errorStack.begin());
       errorStack.push_back(ee); 
 
       return code;
     }
 
-    unsigned int Negotiate() {
+    // Once the device is known to echo, a reply that does not start with its command
+    // carries the tail of the previous one.
+    inline void checkEcho(const std::string& command, const std::vector<unsigned char>& chunk,
+                          const std::function<void()>& lateOutput) {
+      size_t start = 0;
+      while (start < chunk.size() && (chunk[start] == '\r' || chunk[start] == '\n')) ++start;
+
+      size_t length = std::min(chunk.size() - start, command.size());
+      if (length == 0) return;
+
+      bool echoed = std::equal(command.begin(), command.begin() + length, chunk.begin() + start);
+      if (echoed) _echoSeen = true;
+      else if (_echoSeen && _cutByAdaptiveIdle) lateOutput();
+    }
+
+    // Timer callback raising `flag` and waking every waiter on the shared buffer.
+    // It takes _bufferMutex briefly so a waiter between its check and its wait is not
+    // missed, its scopedTimer must therefore go away without _bufferMutex held.
+    inline std::function<void()> wakeOn(std::atomic<bool>& flag) {
+      return [this, &flag]() {
+        {
+          std::lock_guard<std::mutex> lock(_bufferMutex);
+          flag = true;
+        }
+        _bufferCv.notify_all();
+      };
+    }
+
+    // Called by the reader whenever its wait timed out without data.
+    unsigned int Heartbeat() {
+      if (_heartbeat.idle <= 0 || !_negotiated) return RTELNET_SUCCESS;
+
+      auto now = std::chrono::steady_clock::now();
+
+      // An AYT must be answered, a NOP only has to leave the socket (TCP_USER_TIMEOUT covers the ACK).
+      if (_heartbeatPending && now - _lastHeartbeat > std::chrono::milliseconds(_heartbeat.timeout)) {
+        _logger.log(RTELNET_LOG_HEARTBEAT, "Heartbeat was not answered.", 1, LV(_heartbeat.timeout));
+        return PUSH_ERROR(Errors::HEARTBEAT_FAILED);
+      }
+
+      auto lastTraffic = std::max(_lastReceive, _lastHeartbeat);
+      if (now - lastTraffic < std::chrono::milliseconds(_heartbeat.idle)) return RTELNET_SUCCESS;
+
+      std::vector<unsigned char> message = {TelnetCommands::IAC, _heartbeat.command};
+      unsigned int sendStatus = _tcp.SendBin(message);
+      if (sendStatus != RTELNET_SUCCESS) return PUSH_ERROR(Errors::HEARTBEAT_FAILED);
+
+      _lastHeartbeat = now;
+      _heartbeatPending = (_heartbeat.command == TelnetCommands::AYT);
+      _aytReplyPending = _heartbeatPending && !_heartbeat.reply.empty();
+      ++_metrics.heartbeatsSent;
+
+      _logger.log(RTELNET_LOG_HEARTBEAT, "Sent heartbeat.", 3, LV(static_cast<int>(_heartbeat.command)));
+      return RTELNET_SUCCESS;
+    }
+
+    // Connect() failing past the TCP connect: stops the reader and closes the socket,
+    // which gives the admission ticket back. The session stays dead until Reconnect().
+    inline unsigned int abortConnect(unsigned int status) {
+      {
+        std::lock_guard<std::mutex> lock(_bufferMutex);
+        _stopBackground = true;
+        _dead = true;
+      }
+      _bufferCv.notify_all();
+
+      if (_background.joinable() && _background.get_id() != std::this_thread::get_id()) {
+        _tcp.Interrupt();
+        _background.join();
+      }
+
+      endCompression();
+      _tcp.Close();
+      return PUSH_ERROR(status);
+    }
+
+    // Reader side failure: stop reading and hand the session to the reconnect callback.
+    void markDead(unsigned int status) {
+      {
+        std::lock_guard<std::mutex> lock(_bufferMutex);
+        if (_stopBackground) return; // Stopped on purpose (Reconnect(), destruction) or already dead
+        _backgroundError = status;
+        _stopBackground = true;
+        _dead = true;
+      }
+      _bufferCv.notify_all();
+
+      _logger.log(RTELNET_LOG_RECONNECT, "Session is dead.", 1, LV(status));
+
+      if (!_reconnectCallback || _closing) return;
+
+      // Died again while the callback runs: it is fired once more when it returns.
+      _reconnectPending = true;
+      if (_reconnecting.exchange(true)) return;
+
+      std::lock_guard<std::mutex> lock(_reconnectMutex);
+      if (_closing) { _reconnecting = false; return; }
+      if (_reconnector.joinable()) _reconnector.join();
+
+      _reconnector = std::thread([this]() {
+        while (true) {
+          _reconnectPending = false;
+          _reconnectCallback(*this);
+          if (_reconnectPending && !_closing) continue;
+
+          _reconnecting = false;
+          // A death between the check and the reset above would have found _reconnecting set.
+          if (!_reconnectPending || _closing || _reconnecting.exchange(true)) break;
+        }
+      });
+    }
+
+    // Answers a single IAC <command> <option> sequence parsed by the reader. The answer
+    // is queued, ProcessIncoming() sends the answers of a whole chunk in one write.
+    unsigned int Negotiate(unsigned char command, unsigned char option) {
       if (!_connected) return PUSH_ERROR(Errors::NOT_CONNECTED);
 
-      _logger.log(RTELNET_LOG_NEGOTIATE, "Trying to negotiate.", 2);
-    
-      std::vector<unsigned char> buffer;
+      _logger.printTelnet({TelnetCommands::IAC, command, option}, 1);
 
-      while (true) {
-        // Peek in the buffer
-        buffer.clear();
-        unsigned int bufferPeek = _tcp.Read(buffer, 3, MSG_PEEK);
-        if (bufferPeek != RTELNET_SUCCESS) return PUSH_ERROR(bufferPeek);
+      if (command == TelnetCommands::DO || command == TelnetCommands::WILL) {
+        std::lock_guard<std::mutex> lock(_bufferMutex);
+        if (std::find(_observedRequests.begin(), _observedRequests.end(), std::make_pair(command, option)) == _observedRequests.end()) {
+          _observedRequests.emplace_back(command, option);
+        }
+      }
 
-        _logger.printTelnet(buffer, 1);
+      // An option we already agreed to in AnswerEarly() is now enabled on both ends,
+      // agreeing again would start a negotiation loop. Refusals are always repeated.
+      unsigned char answer = 0;
+      auto early = std::find(_earlyAccepted.begin(), _earlyAccepted.end(), std::make_pair(command, option));
+      if (early != _earlyAccepted.end()) {
+        _earlyAccepted.erase(early);
+        _logger.log(RTELNET_LOG_NEGOTIATE, "Already answered.", 3, LV(command), LV(option));
+      } else {
+        answer = Answer(command, option);
+      }
 
-        ssize_t n = static_cast<ssize_t>(buffer.size());
-        if (n < 3) {
-          _negotiated = false;
-          return PUSH_ERROR(Errors::SHARED_BUFFER_EMPTY);
+      if (!_negotiated) {
+        {
+          std::lock_guard<std::mutex> lock(_bufferMutex);
+          _negotiated = true;
         }
+        _bufferCv.notify_all();
+      }
 
-        // If not a negotiation packet, exit
-        if (buffer[0] != TelnetCommands::IAC) {
-          if (!_negotiated) {
-            return PUSH_ERROR(Errors::NOT_A_NEGOTIATION);
-          } else {
-            break;
+      // WONT/DONT are acknowledgements, nothing to answer.
+      if (answer == 0) return RTELNET_SUCCESS;
+
+      std::vector<unsigned char> response = {static_cast<unsigned char>(TelnetCommands::IAC), answer, option};
+      _pendingAnswers.insert(_pendingAnswers.end(), response.begin(), response.end());
+      _logger.printTelnet(response, 0);
+
+      return RTELNET_SUCCESS;
+    }
+
+    // Our answer to a DO/WILL request, 0 for WONT/DONT which need none.
+    unsigned char Answer(unsigned char command, unsigned char option) {
+      std::vector<unsigned char> response = {
+        static_cast<unsigned char>(TelnetCommands::IAC),
+        static_cast<unsigned char>(0),
+        static_cast<unsigned char>(option)
+      };
+
+      switch (command) {
+        case TelnetCommands::DO:
+          switch (option) {
+            case TelnetOptions::BINARY:               response[1] = TelnetCommands::WILL; _binarySendEnabled = true; break;
+            case TelnetOptions::ECHO:                 response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::SGA:                  response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::STATUS:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::TIMING_MARK:          response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::TERMINAL_TYPE:        response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAWS:                 response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::LINEMODE:             response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NEW_ENVIRON:          response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::X_DISPLAY_LOCATION:   response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::LOGOUT:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::ENVIRONMENT_OPTION:   response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::AUTHENTICATION:       response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::ENCRYPTION:           response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::RCP:                  response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAMS:                 response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::RCTE:                 response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAOL:                 response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAOP:                 response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAOCRD:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAOHTS:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAOHTD:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAOFFD:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAOVTS:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAOVTD:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::NAOLFD:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::EXTEND_ASCII:         response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::BM:                   response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::DET:                  response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::SUPDUP:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::SUPDUP_OUTPUT:        response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::SEND_LOCATION:        response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::END_OF_RECORD:        response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::TACACS_UID:           response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::OUTPUT_MARKING:       response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::TTYLOC:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::REMOTE_FLOW_CONTROL:  response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::TOGGLE_FLOW_CONTROL:  response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::X3_PAD:               response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::MSDP:                 response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::MSSP:                 response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::ZMP:                  response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::MUX:                  response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::MCCP1:                response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::MCCP2:                response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::GMCP:                 response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::PRAGMA_LOGON:         response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::SSPI_LOGON:           response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::PRAGMA_HEARTBEAT:     response[1] = TelnetCommands::WONT; break;
+            case TelnetOptions::TERMINAL_SPEED:       response[1] = TelnetCommands::WONT; break;
+            default:                                  response[1] = TelnetCommands::WONT; break;
+          }
+          break;
+
+        case TelnetCommands::WILL:
+          switch (option) {
+            case TelnetOptions::BINARY:               response[1] = TelnetCommands::DO; _binaryReceiveEnabled = true; break;
+            case TelnetOptions::ECHO:                 response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::SGA:                  response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::STATUS:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::TIMING_MARK:          response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::TERMINAL_TYPE:        response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAWS:                 response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::LINEMODE:             response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NEW_ENVIRON:          response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::X_DISPLAY_LOCATION:   response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::LOGOUT:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::ENVIRONMENT_OPTION:   response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::AUTHENTICATION:       response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::ENCRYPTION:           response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::RCP:                  response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAMS:                 response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::RCTE:                 response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAOL:                 response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAOP:                 response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAOCRD:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAOHTS:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAOHTD:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAOFFD:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAOVTS:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAOVTD:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::NAOLFD:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::EXTEND_ASCII:         response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::BM:                   response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::DET:                  response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::SUPDUP:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::SUPDUP_OUTPUT:        response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::SEND_LOCATION:        response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::END_OF_RECORD:        response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::TACACS_UID:           response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::OUTPUT_MARKING:       response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::TTYLOC:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::REMOTE_FLOW_CONTROL:  response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::TOGGLE_FLOW_CONTROL:  response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::X3_PAD:               response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::MSDP:                 response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::MSSP:                 response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::ZMP:                  response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::MUX:                  response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::MCCP1:                response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::MCCP2:                response[1] = acceptMCCP2() ? TelnetCommands::DO : TelnetCommands::DONT; break;
+            case TelnetOptions::GMCP:                 response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::PRAGMA_LOGON:         response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::SSPI_LOGON:           response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::PRAGMA_HEARTBEAT:     response[1] = TelnetCommands::DONT; break;
+            case TelnetOptions::TERMINAL_SPEED:       response[1] = TelnetCommands::DONT; break;
+            default:                                  response[1] = TelnetCommands::DONT; break;
           }
+          break;
+
+        case TelnetCommands::WONT:
+        case TelnetCommands::DONT:
+          // Add supprt for these later.
+          break;
+      }
+
+      return response[1];
+    }
+
+    // Answers the requests this host made on its last connection before it makes
+    // them again, in one write. Runs before the reader starts.
+    unsigned int AnswerEarly() {
+      _observedRequests.clear();
+      _earlyAccepted.clear();
+      _pendingAnswers.clear();
+
+      if (!_negotiationProfiles) return RTELNET_SUCCESS;
+
+      optionRequests requests = _negotiationProfiles->requestsFor(_address, _port);
+      if (requests.empty()) return RTELNET_SUCCESS;
+
+      std::vector<unsigned char> answers;
+      for (const auto& [command, option] : requests) {
+        unsigned char answer = Answer(command, option);
+        if (answer == 0) continue;
+
+        answers.insert(answers.end(), {static_cast<unsigned char>(TelnetCommands::IAC), answer, option});
+        if (answer == TelnetCommands::WILL || answer == TelnetCommands::DO) _earlyAccepted.emplace_back(command, option);
+      }
+      if (answers.empty()) return RTELNET_SUCCESS;
+
+      unsigned int sendStatus = _tcp.SendBin(answers);
+      if (sendStatus != RTELNET_SUCCESS) return PUSH_ERROR(sendStatus);
+
+      _metrics.earlyAnswers += answers.size() / 3;
+      _logger.log(RTELNET_LOG_NEGOTIATE, "Answered from the host profile.", 2, LV(requests.size()));
+
+      // Nothing left to wait for, Login() can watch for the login prompt right away.
+      _negotiated = true;
+      return RTELNET_SUCCESS;
+    }
+
+    // Handles IAC SB <option> ... IAC SE once the whole sequence was parsed.
+    unsigned int Subnegotiate(unsigned char option, const std::vector<unsigned char>& payload) {
+      _logger.log(RTELNET_LOG_NEGOTIATE, "Subnegotiation.", 3, LV(option), LV(payload));
+
+      if (option == TelnetOptions::MCCP2 && acceptMCCP2()) {
+        // A restart inside the compressed stream would drop the inflater state.
+        if (_compressing) {
+          _logger.log(RTELNET_LOG_MCCP, "Ignored compression restart.", 2);
+          return RTELNET_SUCCESS;
         }
+        return startCompression();
+      }
 
-        // Read the full 3-byte sequence
-        buffer.clear();
-        unsigned int bufferResult = _tcp.Read(buffer, 3);
-        if (bufferPeek != RTELNET_SUCCESS) return PUSH_ERROR(bufferResult);
-
-        unsigned char command = buffer[1];
-        unsigned char option  = buffer[2];
-        std::vector<unsigned char> response = {
-          static_cast<unsigned char>(TelnetCommands::IAC),
-          static_cast<unsigned char>(0),
-          static_cast<unsigned char>(option)
-        };
+      return RTELNET_SUCCESS;
+    }
 
-        switch (command) {
-          case TelnetCommands::DO:
-            switch (option) {
-              case TelnetOptions::BINARY:               response[1] = TelnetCommands::WILL; _binarySendEnabled = true; break;
-              case TelnetOptions::ECHO:                 response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::SGA:                  response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::STATUS:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::TIMING_MARK:          response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::TERMINAL_TYPE:        response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAWS:                 response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::LINEMODE:             response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NEW_ENVIRON:          response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::X_DISPLAY_LOCATION:   response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::LOGOUT:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::ENVIRONMENT_OPTION:   response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::AUTHENTICATION:       response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::ENCRYPTION:           response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::RCP:                  response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAMS:                 response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::RCTE:                 response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAOL:                 response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAOP:                 response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAOCRD:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAOHTS:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAOHTD:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAOFFD:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAOVTS:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAOVTD:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::NAOLFD:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::EXTEND_ASCII:         response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::BM:                   response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::DET:                  response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::SUPDUP:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::SUPDUP_OUTPUT:        response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::SEND_LOCATION:        response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::END_OF_RECORD:        response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::TACACS_UID:           response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::OUTPUT_MARKING:       response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::TTYLOC:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::REMOTE_FLOW_CONTROL:  response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::TOGGLE_FLOW_CONTROL:  response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::X3_PAD:               response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::MSDP:                 response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::MSSP:                 response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::ZMP:                  response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::MUX:                  response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::MCCP1:                response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::MCCP2:                response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::GMCP:                 response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::PRAGMA_LOGON:         response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::SSPI_LOGON:           response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::PRAGMA_HEARTBEAT:     response[1] = TelnetCommands::WONT; break;
-              case TelnetOptions::TERMINAL_SPEED:       response[1] = TelnetCommands::WONT; break;
-              default:                                  response[1] = TelnetCommands::WONT; break;
-            }
+    inline bool acceptMCCP2() const {
+#ifdef RTELNET_WITH_ZLIB
+      return _mccp2;
+#else
+      return false;
+#endif
+    }
+
+    inline unsigned int startCompression() {
+#ifdef RTELNET_WITH_ZLIB
+      _zstream = z_stream{};
+      if (inflateInit(&_zstream) != Z_OK) return PUSH_ERROR(Errors::COMPRESSION_FAILED);
+      _compressing = true;
+
+      _logger.log(RTELNET_LOG_MCCP, "Compression started.", 2);
+#endif
+      return RTELNET_SUCCESS;
+    }
+
+    inline void endCompression() {
+#ifdef RTELNET_WITH_ZLIB
+      if (!_compressing) return;
+      inflateEnd(&_zstream);
+      _compressing = false;
+
+      _logger.log(RTELNET_LOG_MCCP, "Compression ended.", 2, LV(_metrics.bytesOnWire.load()), LV(_metrics.bytesInflated.load()));
+#endif
+    }
+
+    // Entry point of the reader: raw socket bytes in, data bytes out to the shared buffer.
+    unsigned int ProcessIncoming(const unsigned char* data, size_t size) {
+      _metrics.bytesOnWire += size;
+
+      std::vector<unsigned char> delivered;
+      delivered.reserve(size);
+
+      while (size > 0) {
+        size_t consumed = 0;
+        unsigned int status = _compressing
+          ? Inflate(data, size, consumed, delivered)
+          : ParseTelnet(data, size, consumed, delivered);
+        if (status != RTELNET_SUCCESS) return status;
+
+        data += consumed;
+        size -= consumed;
+      }
+
+      if (_aytReplyPending) ConsumeAytReply(delivered);
+
+      if (_respondersArmed && _logged_in && !delivered.empty()) Respond(delivered);
+
+      // Sent before the data is handed over, so a reply to it follows our answers.
+      if (!_pendingAnswers.empty()) {
+        unsigned int sendStatus = _tcp.SendBin(_pendingAnswers);
+        _pendingAnswers.clear();
+        if (sendStatus != RTELNET_SUCCESS) return PUSH_ERROR(sendStatus);
+      }
+
+      if (!delivered.empty()) {
+        std::lock_guard<std::mutex> lock(_bufferMutex);
+        _sharedBuffer.insert(_sharedBuffer.end(), delivered.begin(), delivered.end());
+        _metrics.bytesDelivered += delivered.size();
+      }
+      if (!delivered.empty()) _bufferCv.notify_all();
+
+      return RTELNET_SUCCESS;
+    }
+
+    // Takes the answer to our AYT out of the data, with the line breaks around it, so it
+    // neither shows up in the next command's output nor counts as late output.
+    void ConsumeAytReply(std::vector<unsigned char>& data) {
+      if (std::chrono::steady_clock::now() - _lastHeartbeat > std::chrono::milliseconds(_heartbeat.timeout)) {
+        _aytReplyPending = false;
+        return;
+      }
+
+      const std::string& reply = _heartbeat.reply;
+      auto found = std::search(data.begin(), data.end(), reply.begin(), reply.end());
+      if (found == data.end()) return;
+
+      auto first = found;
+      auto last = found + reply.size();
+      while (first != data.begin() && (*(first - 1) == '\r' || *(first - 1) == '\n')) --first;
+      while (last != data.end() && (*last == '\r' || *last == '\n')) ++last;
+      data.erase(first, last);
+
+      _aytReplyPending = false;
+      _logger.log(RTELNET_LOG_HEARTBEAT, "Consumed the AYT answer.", 3, LV(reply));
+    }
+
+    // Queues the answers of the auto responder rules matching in `data`, in the order
+    // the patterns appear. Only matches ending in `data` count, a prompt already
+    // answered in the previous chunk is not answered again.
+    void Respond(const std::vector<unsigned char>& data) {
+      std::lock_guard<std::mutex> lock(_responderMutex);
+
+      size_t carried = _responderTail.size();
+      _responderTail.append(data.begin(), data.end());
+
+      std::vector<std::pair<size_t, size_t>> hits; // (end of the match, rule)
+      for (size_t r = 0; r < _responders.size(); ++r) {
+        const autoResponse& rule = _responders[r];
+        uint64_t left = (rule.maxFires > 0) ? rule.maxFires - std::min<uint64_t>(rule.fired, rule.maxFires) : UINT64_MAX;
+
+        size_t from = (carried >= rule.pattern.size()) ? carried - rule.pattern.size() + 1 : 0;
+        for (size_t at = _responderTail.find(rule.pattern, from); at != std::string::npos && left > 0;
+             at = _responderTail.find(rule.pattern, at + rule.pattern.size()), --left) {
+          hits.emplace_back(at + rule.pattern.size(), r);
+        }
+      }
+      std::sort(hits.begin(), hits.end());
+
+      for (const auto& [end, r] : hits) {
+        autoResponse& rule = _responders[r];
+        ++rule.fired;
+        ++_metrics.autoResponses;
+        for (unsigned char c : rule.response) {
+          _pendingAnswers.push_back(c);
+          if (!(_binarySendEnabled && _binaryReceiveEnabled) && c == TelnetCommands::IAC) _pendingAnswers.push_back(c);
+        }
+        _logger.log(RTELNET_LOG_RESPOND, "Answered a prompt.", 2, LV(rule.pattern), LV(rule.fired));
+      }
+
+      size_t keep = (_responderWindow > 0) ? _responderWindow - 1 : 0;
+      if (_responderTail.size() > keep) _responderTail.erase(0, _responderTail.size() - keep);
+    }
+
+    // Telnet state machine, stops right after IAC SE when MCCP2 starts so the
+    // rest of the chunk goes to the inflater.
+    unsigned int ParseTelnet(const unsigned char* data, size_t size, size_t& consumed, std::vector<unsigned char>& out) {
+      size_t i = 0;
+
+      while (i < size) {
+        unsigned char c = data[i];
+
+        switch (_parserState) {
+          case parserState::DATA: {
+            const void* iac = memchr(data + i, TelnetCommands::IAC, size - i);
+            size_t end = iac ? static_cast<size_t>(static_cast<const unsigned char*>(iac) - data) : size;
+            out.insert(out.end(), data + i, data + end);
+            i = end;
+            if (iac) { _parserState = parserState::IAC_SEEN; ++i; }
             break;
+          }
 
-          case TelnetCommands::WILL:
-            switch (option) {
-              case TelnetOptions::BINARY:               response[1] = TelnetCommands::DO; _binaryReceiveEnabled = true; break;
-              case TelnetOptions::ECHO:                 response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::SGA:                  response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::STATUS:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::TIMING_MARK:          response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::TERMINAL_TYPE:        response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAWS:                 response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::LINEMODE:             response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NEW_ENVIRON:          response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::X_DISPLAY_LOCATION:   response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::LOGOUT:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::ENVIRONMENT_OPTION:   response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::AUTHENTICATION:       response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::ENCRYPTION:           response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::RCP:                  response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAMS:                 response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::RCTE:                 response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAOL:                 response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAOP:                 response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAOCRD:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAOHTS:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAOHTD:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAOFFD:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAOVTS:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAOVTD:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::NAOLFD:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::EXTEND_ASCII:         response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::BM:                   response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::DET:                  response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::SUPDUP:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::SUPDUP_OUTPUT:        response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::SEND_LOCATION:        response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::END_OF_RECORD:        response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::TACACS_UID:           response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::OUTPUT_MARKING:       response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::TTYLOC:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::REMOTE_FLOW_CONTROL:  response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::TOGGLE_FLOW_CONTROL:  response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::X3_PAD:               response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::MSDP:                 response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::MSSP:                 response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::ZMP:                  response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::MUX:                  response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::MCCP1:                response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::MCCP2:                response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::GMCP:                 response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::PRAGMA_LOGON:         response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::SSPI_LOGON:           response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::PRAGMA_HEARTBEAT:     response[1] = TelnetCommands::DONT; break;
-              case TelnetOptions::TERMINAL_SPEED:       response[1] = TelnetCommands::DONT; break;
-              default:                                  response[1] = TelnetCommands::DONT; break;
+          case parserState::IAC_SEEN:
+            ++i;
+            switch (c) {
+              case TelnetCommands::IAC:  out.push_back(c); _parserState = parserState::DATA; break;
+              case TelnetCommands::DO:
+              case TelnetCommands::DONT:
+              case TelnetCommands::WILL:
+              case TelnetCommands::WONT: _parserCommand = c; _parserState = parserState::OPTION; break;
+              case TelnetCommands::SB:   _parserState = parserState::SB_OPTION; break;
+              default:                   _parserState = parserState::DATA; break; // Two byte commands (NOP, GA, ...)
             }
             break;
 
-          case TelnetCommands::WONT:
-          case TelnetCommands::DONT:
-            // Add supprt for these later.
+          case parserState::OPTION: {
+            ++i;
+            _parserState = parserState::DATA;
+            unsigned int status = Negotiate(_parserCommand, c);
+            if (status != RTELNET_SUCCESS) return PUSH_ERROR(status);
             break;
-        }
+          }
 
-        
-        _tcp.SendBin(response);
-        _negotiated = true;
-        _logger.printTelnet(response, 0);
+          case parserState::SB_OPTION:
+            ++i;
+            _sbOption = c;
+            _sbPayload.clear();
+            _parserState = parserState::SB_DATA;
+            break;
+
+          case parserState::SB_DATA:
+            ++i;
+            if (c == TelnetCommands::IAC) _parserState = parserState::SB_IAC;
+            else if (_sbPayload.size() < RTELNET_SB_MAX_SIZE) _sbPayload.push_back(c);
+            break;
+
+          case parserState::SB_IAC: {
+            ++i;
+            if (c != TelnetCommands::SE) {
+              if (c == TelnetCommands::IAC && _sbPayload.size() < RTELNET_SB_MAX_SIZE) _sbPayload.push_back(c);
+              _parserState = parserState::SB_DATA;
+              break;
+            }
+
+            _parserState = parserState::DATA;
+            bool wasCompressing = _compressing;
+            unsigned int status = Subnegotiate(_sbOption, _sbPayload);
+            if (status != RTELNET_SUCCESS) return PUSH_ERROR(status);
+
+            if (!wasCompressing && _compressing) {
+              consumed = i;
+              return RTELNET_SUCCESS;
+            }
+            break;
+          }
+        }
       }
 
-      _logger.log(RTELNET_LOG_NEGOTIATE, "Finished negotiation sequence.", 2);
+      consumed = size;
       return RTELNET_SUCCESS;
     }
 
+    // Inflates MCCP2 bytes and runs the result through the telnet parser.
+    unsigned int Inflate(const unsigned char* data, size_t size, size_t& consumed, std::vector<unsigned char>& out) {
+#ifdef RTELNET_WITH_ZLIB
+      unsigned char inflated[RTELNET_INFLATE_CHUNK];
+      _zstream.next_in = const_cast<Bytef*>(data);
+      _zstream.avail_in = static_cast<uInt>(size);
+
+      int ret = Z_OK;
+      do {
+        _zstream.next_out = inflated;
+        _zstream.avail_out = sizeof(inflated);
+
+        ret = inflate(&_zstream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+          endCompression();
+          return PUSH_ERROR(Errors::COMPRESSION_FAILED);
+        }
+
+        size_t produced = sizeof(inflated) - _zstream.avail_out;
+        _metrics.bytesInflated += produced;
+
+        size_t parsed = 0;
+        while (parsed < produced) {
+          size_t step = 0;
+          unsigned int status = ParseTelnet(inflated + parsed, produced - parsed, step, out);
+          if (status != RTELNET_SUCCESS) return status;
+          parsed += step;
+        }
+      } while (ret == Z_OK && (_zstream.avail_in > 0 || _zstream.avail_out == 0));
+
+      consumed = size - _zstream.avail_in;
+
+      // Server ended compression, whatever follows is plain telnet again.
+      if (ret == Z_STREAM_END) endCompression();
+
+      return RTELNET_SUCCESS;
+#else
+      (void)data; (void)out;
+      consumed = size;
+      return PUSH_ERROR(Errors::COMPRESSION_FAILED);
+#endif
+    }
+
     unsigned int expectOutput(const std::string& expect, std::vector<unsigned char>& buffer) {
         if (!_connected) return PUSH_ERROR(Errors::NOT_CONNECTED);
         if (!_negotiated) return PUSH_ERROR(Errors::NOT_NEGOTIATED);
 
-        for (int i = 0; i < 300; ++i) {
-          unsigned int readStatus = Read(buffer);
-          if (readStatus != RTELNET_SUCCESS) return PUSH_ERROR(readStatus);
+        std::atomic<bool> expired{false};
+        scopedTimer deadline(timerWheel::shared(), std::chrono::milliseconds(RTELNET_EXPECT_TIMEOUT), wakeOn(expired));
+
+        while (true) {
+          {
+            std::unique_lock<std::mutex> lock(_bufferMutex);
+            _bufferCv.wait(lock, [this, &expired]() { return !_sharedBuffer.empty() || _stopBackground || expired; });
+
+            if (_sharedBuffer.empty()) break;
+
+            buffer.insert(buffer.end(), _sharedBuffer.begin(), _sharedBuffer.end());
+            _sharedBuffer.clear();
+          }
 
           _logger.log("EXPECT", "Expecting.", 2, LV(expect) , LV(buffer));
 
@@ -915,13 +2469,14 @@ namespace rtnt {
           if (cleanedBuffer.find(expect) != std::string::npos) {
               return RTELNET_SUCCESS;
           }
-
-          std::this_thread::sleep_for(std::chrono::milliseconds(200));
         }
 
         return PUSH_ERROR(Errors::CANT_FIND_EXPECTED);
     }
 
+    // Login as a small state machine driven by the reader: each chunk is checked
+    // against _login's patterns as soon as it arrives, nothing is polled. A device
+    // that asks for a password straight away skips the username step.
     inline unsigned int Login() {
       if (!_connected) return PUSH_ERROR(Errors::NOT_CONNECTED);
       if (!_negotiated) return PUSH_ERROR(Errors::NOT_NEGOTIATED);
@@ -930,69 +2485,101 @@ namespace rtnt {
 
       _logger.log(RTELNET_LOG_LOGIN, "Trying to login.", 2, LV(_username), LV(_password));
 
-      std::vector<unsigned char> buffer;
-
-      // Enter login
-      buffer.clear();
-      unsigned int loginStatus = expectOutput("login:", buffer);
-      if (loginStatus != RTELNET_SUCCESS) return PUSH_ERROR(loginStatus);
-      unsigned int loginResponse = _tcp.Send(_username + "\n");
-      if (loginResponse != RTELNET_SUCCESS) return PUSH_ERROR(loginResponse);
-
-      // Enter password
-      buffer.clear();
-      unsigned int passwordStatus = expectOutput("Password:", buffer);
-      if (passwordStatus != RTELNET_SUCCESS) return PUSH_ERROR(passwordStatus);
-      unsigned int passwordResponse = _tcp.Send(_password + "\n");
-      if (passwordResponse != RTELNET_SUCCESS) return PUSH_ERROR(passwordResponse);
+      enum class loginStep { USERNAME, PASSWORD, PROMPT };
+      loginStep step = loginStep::USERNAME;
 
-      // Search for "Login incorrect"
-      std::string accumulated;
-      buffer.clear();
-      auto start = std::chrono::steady_clock::now();
+      // Output since the last answer. Until the password is sent it is taken out of
+      // the shared buffer, after that it is left there (banner and prompt).
+      std::string pending;
+      size_t seen = 0;
 
-      _logger.log(RTELNET_LOG_LOGIN, "Searching for Login incorrect.", 2);
+      std::atomic<bool> expired{false};
+      scopedTimer deadline(timerWheel::shared(), std::chrono::milliseconds(_login.timeout), wakeOn(expired));
 
       while (true) {
+        {
+          std::unique_lock<std::mutex> lock(_bufferMutex);
+          _bufferCv.wait(lock, [&]() { return _sharedBuffer.size() != seen || _stopBackground || expired; });
 
-          unsigned int readStatus = Read(buffer, RTELNET_BUFFER_SIZE, MSG_PEEK);
-          if (readStatus != RTELNET_SUCCESS) return PUSH_ERROR(readStatus);
-
-          if (!buffer.empty()) {
-              std::string temp(reinterpret_cast<const char*>(buffer.data()), buffer.size());
-              temp.erase(std::remove(temp.begin(), temp.end(), '\r'), temp.end());
-              temp.erase(std::remove(temp.begin(), temp.end(), '\n'), temp.end());
+          if (_sharedBuffer.size() == seen) break;
 
-              accumulated += temp;
+          if (step == loginStep::PROMPT) {
+            pending.append(_sharedBuffer.begin() + seen, _sharedBuffer.end());
+            seen = _sharedBuffer.size();
+          } else {
+            pending.append(_sharedBuffer.begin(), _sharedBuffer.end());
+            _sharedBuffer.clear();
           }
+        }
 
-          _logger.log(RTELNET_LOG_LOGIN, "Still searching.", 2, LV(accumulated));
+        _logger.log(RTELNET_LOG_LOGIN, "Login output.", 3, LV(pending));
 
+        // A banner before the first answer may well say "Access denied" (to unauthorized
+        // users). Failures only count once credentials went out, and not in output that
+        // already ends at the shell prompt.
+        bool atPrompt = step == loginStep::PROMPT && endsWithAny(pending, _login.prompts);
+        if (step != loginStep::USERNAME && !atPrompt && containsAny(pending, _login.failures)) {
+          return PUSH_ERROR(Errors::FAILED_LOGIN);
+        }
 
-          if (accumulated.find("Login incorrect") != std::string::npos) {
-              return PUSH_ERROR(Errors::FAILED_LOGIN);
-          }
+        if (step == loginStep::USERNAME && endsWithAny(pending, _login.usernamePrompts)) {
+          unsigned int sendStatus = _tcp.Send(_username + "\n");
+          if (sendStatus != RTELNET_SUCCESS) return PUSH_ERROR(sendStatus);
+          step = loginStep::PASSWORD;
+        } else if (step != loginStep::PROMPT && endsWithAny(pending, _login.passwordPrompts)) {
+          unsigned int sendStatus = _tcp.Send(_password + "\n");
+          if (sendStatus != RTELNET_SUCCESS) return PUSH_ERROR(sendStatus);
+          step = loginStep::PROMPT;
+        } else if (atPrompt) {
+          break;
+        } else {
+          continue;
+        }
 
-          // possible: detect prompt here, e.g., "$ " or "> "
-          if (accumulated.find("$") != std::string::npos || accumulated.find(">") != std::string::npos || accumulated.find("#") != std::string::npos) {
-              break;
-          }
+        pending.clear();
+        deadline.reset(std::chrono::milliseconds(_login.timeout));
+      }
 
-          auto now = std::chrono::steady_clock::now();
-          if (std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count() > RTELNET_LOGIN_TIMEOUT) {
-              break;
-          }
+      if (_stopBackground) return PUSH_ERROR(Errors::SESSION_DEAD);
+      if (step != loginStep::PROMPT) return PUSH_ERROR(Errors::CANT_FIND_EXPECTED);
 
-          std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      }
+      // No failure after the password: a prompt outside _login.prompts still counts as logged in.
+      if (expired) _logger.log(RTELNET_LOG_LOGIN, "No known prompt, assuming logged in.", 1, LV(pending));
 
       _logged_in = true;
+      _tcp.endHandshake();
 
       _logger.log(RTELNET_LOG_LOGIN, "Logged in successfully.", 2, LV(_username), LV(_password));
 
       return RTELNET_SUCCESS;
     }
 
+    // `text` ends with one of `patterns`, line breaks and trailing spaces ignored.
+    static inline bool endsWithAny(const std::string& text, const std::vector<std::string>& patterns) {
+      size_t end = text.find_last_not_of(" \t\r\n");
+      if (end == std::string::npos) return false;
+
+      std::string_view trimmed(text.data(), end + 1);
+      for (const std::string& pattern : patterns) {
+        if (!pattern.empty() && trimmed.size() >= pattern.size() &&
+            trimmed.compare(trimmed.size() - pattern.size(), pattern.size(), pattern) == 0) return true;
+      }
+      return false;
+    }
+
+    // A recv of 0 bytes would read as a closed peer, a huge one as a huge allocation.
+    static inline int chunkSize(int requested) {
+      return (requested > 0) ? std::min(requested, RTELNET_READ_CHUNK_MAX) : RTELNET_BUFFER_SIZE;
+    }
+
+    static inline bool containsAny(const std::string& text, const std::vector<std::string>& patterns) {
+      for (const std::string& pattern : patterns) {
+        if (!pattern.empty() && text.find(pattern) != std::string::npos) return true;
+      }
+      return false;
+    }
+
+    friend class tcpTransport;
     friend class tcp;
     friend class Logger;
   };
@@ -0,0 +1,232 @@
+/*
+* Adaptive idle timeout, learned per host.
+*
+* Execute() decides a command is done once the device stays quiet for the idle
+* timeout. Instead of one fixed value, each host keeps two histograms across its
+* commands: time to first byte, and the longest gap between two chunks. The cutoff
+* is a high percentile of those plus a margin, so fast devices stop waiting early
+* and slow ones are not cut short.
+*
+* Output arriving after a command was cut off widens that host's cutoffs. Until a
+* host has enough samples the fixed idle timeout is used (widened the same way).
+*
+* Profiles can be shared by every session of a process and persisted to a small
+* text file between runs.
+*/
+#ifndef RTELNET_ADAPTIVE_H
+#define RTELNET_ADAPTIVE_H
+
+#include "rtelnet_files.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+inline constexpr int    RTELNET_ADAPTIVE_BUCKETS     = 64;
+inline constexpr double RTELNET_ADAPTIVE_FIRST_EDGE  = 0.1;  // ms, upper edge of the first bucket
+inline constexpr double RTELNET_ADAPTIVE_GROWTH      = 1.25; // Bucket edges grow geometrically, up to ~2 minutes
+inline constexpr uint32_t RTELNET_ADAPTIVE_WINDOW    = 4096; // Samples kept before halving the counts
+inline constexpr double RTELNET_ADAPTIVE_SCALE_MAX   = 64.0; // Ceiling of the late output penalty
+
+namespace rtnt {
+
+  struct adaptiveIdleOptions {
+    double percentile = 0.99;
+    double marginRatio = 0.5; // cutoff = percentile * (1 + marginRatio) + marginMs
+    int marginMs = 10;
+    int minIdle = 10;         // ms
+    int maxIdle = 60000;      // ms
+    uint32_t minSamples = 32; // Commands seen before the cutoff is trusted
+  };
+
+  // Log scale histogram of durations in ms, old samples fade as new ones arrive.
+  class durationHistogram {
+  public:
+    inline void record(double ms) {
+      ++_counts[bucketOf(ms)];
+      if (++_total >= RTELNET_ADAPTIVE_WINDOW) age();
+    }
+
+    // Upper edge of the bucket holding the percentile, in ms.
+    inline double percentile(double fraction) const {
+      if (_total == 0) return 0;
+
+      uint64_t target = static_cast<uint64_t>(std::ceil(fraction * _total));
+      uint64_t seen = 0;
+      for (int bucket = 0; bucket < RTELNET_ADAPTIVE_BUCKETS; ++bucket) {
+        seen += _counts[bucket];
+        if (seen >= target) return edge(bucket);
+      }
+      return edge(RTELNET_ADAPTIVE_BUCKETS - 1);
+    }
+
+    inline uint32_t total() const { return _total; }
+
+    inline void write(std::ostream& out) const {
+      for (uint32_t count : _counts) out << ' ' << count;
+    }
+
+    inline bool read(std::istream& in) {
+      _total = 0;
+      for (uint32_t& count : _counts) {
+        if (!(in >> count)) return false;
+        _total += count;
+      }
+      return true;
+    }
+
+    static inline double edge(int bucket) {
+      return RTELNET_ADAPTIVE_FIRST_EDGE * std::pow(RTELNET_ADAPTIVE_GROWTH, bucket);
+    }
+
+  private:
+    std::array<uint32_t, RTELNET_ADAPTIVE_BUCKETS> _counts{};
+    uint32_t _total = 0;
+
+    static inline int bucketOf(double ms) {
+      if (ms <= RTELNET_ADAPTIVE_FIRST_EDGE) return 0;
+      int bucket = static_cast<int>(std::ceil(std::log(ms / RTELNET_ADAPTIVE_FIRST_EDGE) / std::log(RTELNET_ADAPTIVE_GROWTH)));
+      return std::min(bucket, RTELNET_ADAPTIVE_BUCKETS - 1);
+    }
+
+    inline void age() {
+      _total = 0;
+      for (uint32_t& count : _counts) {
+        count /= 2;
+        _total += count;
+      }
+    }
+  };
+
+  // What one host has shown so far. Thread safe, shared by its sessions.
+  class idleProfile {
+  public:
+    // Fed once per command, a reply that came in one chunk has a gap of 0.
+    inline void record(double firstByteMs, double maxGapMs) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _firstByte.record(firstByteMs);
+      _gaps.record(maxGapMs);
+      _scale = std::max(1.0, _scale * 0.98); // Late output penalties wear off
+    }
+
+    // Output showed up after a command was cut off: the cutoffs were too short.
+    inline void penalize() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _scale = std::min(_scale * 2.0, RTELNET_ADAPTIVE_SCALE_MAX);
+    }
+
+    inline int firstByteCutoff(int fallback, const adaptiveIdleOptions& options) const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return cutoff(_firstByte, fallback, options);
+    }
+
+    inline int gapCutoff(int fallback, const adaptiveIdleOptions& options) const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return cutoff(_gaps, fallback, options);
+    }
+
+    inline void write(std::ostream& out) const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      out << _scale << " ttfb";
+      _firstByte.write(out);
+      out << " gap";
+      _gaps.write(out);
+    }
+
+    inline bool read(std::istream& in) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::string label;
+      if (!(in >> _scale >> label) || label != "ttfb") return false;
+      // A hand edited or corrupt file must not zero or blow up every idle window.
+      _scale = (_scale >= 1.0) ? std::min(_scale, RTELNET_ADAPTIVE_SCALE_MAX) : 1.0;
+      return _firstByte.read(in) && (in >> label) && label == "gap" && _gaps.read(in);
+    }
+
+  private:
+    mutable std::mutex _mutex;
+    durationHistogram _firstByte;
+    durationHistogram _gaps;
+    double _scale = 1.0;
+
+    inline int cutoff(const durationHistogram& histogram, int fallback, const adaptiveIdleOptions& options) const {
+      if (histogram.total() < options.minSamples) return std::min(static_cast<int>(fallback * _scale), std::max(fallback, options.maxIdle));
+
+      double learned = histogram.percentile(options.percentile) * (1.0 + options.marginRatio) + options.marginMs;
+      return std::clamp(static_cast<int>(learned * _scale), options.minIdle, options.maxIdle);
+    }
+  };
+
+  // Profiles by host, optionally loaded from and saved to `path`.
+  //
+  // File format, one host per line:
+  //   <address>:<port> <scale> ttfb <64 counts> gap <64 counts>
+  class idleProfiles {
+  public:
+    explicit idleProfiles(std::string path = "", adaptiveIdleOptions options = adaptiveIdleOptions())
+      : _path(std::move(path)), _options(options) {
+      if (!_path.empty()) load();
+    }
+
+    ~idleProfiles() {
+      if (!_path.empty()) save();
+    }
+
+    idleProfiles(const idleProfiles&) = delete;
+    idleProfiles& operator=(const idleProfiles&) = delete;
+
+    inline std::shared_ptr<idleProfile> profileFor(const std::string& address, int port) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::shared_ptr<idleProfile>& profile = _profiles[address + ":" + std::to_string(port)];
+      if (!profile) profile = std::make_shared<idleProfile>();
+      return profile;
+    }
+
+    inline const adaptiveIdleOptions& options() const { return _options; }
+
+    // Missing or unreadable lines are skipped, a bad file only costs the history.
+    inline bool load() {
+      std::ifstream file(_path);
+      if (!file) return false;
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::string line;
+      while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string host;
+        if (!(fields >> host)) continue;
+
+        auto profile = std::make_shared<idleProfile>();
+        if (profile->read(fields)) _profiles[host] = profile;
+      }
+      return true;
+    }
+
+    // Written next to the target and renamed over it, readers never see half a file.
+    // Processes sharing the file each write their own temporary, the last rename wins.
+    inline bool save() const {
+      return writeAtomically(_path, [this](std::ostream& file) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const auto& [host, profile] : _profiles) {
+          file << host << ' ';
+          profile->write(file);
+          file << '\n';
+        }
+      });
+    }
+
+  private:
+    std::string _path;
+    adaptiveIdleOptions _options;
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, std::shared_ptr<idleProfile>> _profiles;
+  };
+
+}
+#endif // RTELNET_ADAPTIVE_H
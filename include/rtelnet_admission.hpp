@@ -0,0 +1,391 @@
+/*
+* Admission control for connects, shared by the sessions of a process.
+*
+* A job opening hundreds of sessions at once gets throttled or dropped by terminal
+* servers and AAA back ends, and the logins then time out in bulk. A session given
+* an admissionController asks it for a ticket before connecting:
+*   - token buckets pace connects, over all hosts and per host,
+*   - concurrent sessions are capped globally, per host and per subnet.
+* The ticket holds its concurrency slots until the session closes, and keeps the
+* controller alive until then: create it with std::make_shared.
+*
+* Waiters queue in memory. Capacity goes to the waiting host served least so far,
+* oldest waiter first within a host, so a host with hundreds of queued sessions
+* does not starve the others and a host at its limit does not hold up the rest.
+*/
+#ifndef RTELNET_ADMISSION_H
+#define RTELNET_ADMISSION_H
+
+#include "rtelnet_adaptive.hpp"
+#include "rtelnet_timer.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace rtnt {
+
+  // 0 disables a limit.
+  struct admissionOptions {
+    double connectRate = 0;       // Connects per second, all hosts
+    double connectBurst = 1;      // Connects allowed back to back before the rate applies
+    double hostConnectRate = 0;   // Connects per second to one host
+    double hostConnectBurst = 1;
+    int maxSessions = 0;          // Open sessions, all hosts
+    int maxPerHost = 0;
+    int maxPerSubnet = 0;
+    int subnetPrefix = 24;        // IPv4 prefix length grouping hosts into a subnet
+    int subnetPrefix6 = 64;       // Same for IPv6, host names are their own subnet
+    int queueTimeout = 0;         // ms a connect may wait for its turn, 0 waits for good
+  };
+
+  struct admissionStats {
+    uint64_t admitted = 0;
+    uint64_t queued = 0;          // Admitted or timed out after waiting
+    uint64_t timedOut = 0;
+    size_t waiting = 0;           // Right now
+    size_t active = 0;            // Tickets held right now
+    double waitP50 = 0;           // ms, over recent admissions
+    double waitP99 = 0;
+    double waitMax = 0;           // ms, longest wait so far
+  };
+
+  class admissionController;
+
+  // Concurrency slots of one admitted connect, given back on release() or destruction.
+  class admissionTicket {
+  public:
+    admissionTicket() = default;
+    ~admissionTicket() { release(); }
+
+    admissionTicket(const admissionTicket&) = delete;
+    admissionTicket& operator=(const admissionTicket&) = delete;
+
+    admissionTicket(admissionTicket&& other) noexcept { *this = std::move(other); }
+    admissionTicket& operator=(admissionTicket&& other) noexcept {
+      if (this != &other) {
+        release();
+        _owner = std::move(other._owner);
+        _host = std::move(other._host);
+        _subnet = std::move(other._subnet);
+      }
+      return *this;
+    }
+
+    inline bool valid() const { return _owner != nullptr; }
+    inline void release();
+
+  private:
+    friend class admissionController;
+    std::shared_ptr<admissionController> _owner; // A session may swap its controller while connected
+    std::string _host;
+    std::string _subnet;
+  };
+
+  class admissionController : public std::enable_shared_from_this<admissionController> {
+  public:
+    explicit admissionController(admissionOptions options = admissionOptions())
+      : _options(options), _global(options.connectRate, options.connectBurst) {}
+
+    admissionController(const admissionController&) = delete;
+    admissionController& operator=(const admissionController&) = delete;
+
+    // Blocks until `address` may connect. False if options().queueTimeout ran out first,
+    // or right away when the controller is not owned by a std::shared_ptr.
+    inline bool acquire(const std::string& address, admissionTicket& ticket, double& waitedMs) {
+      ticket.release();
+      waitedMs = 0;
+
+      // The ticket keeps the controller alive, shared_from_this() after the grant would throw.
+      if (weak_from_this().expired()) return false;
+
+      waiter self;
+      self.host = address;
+      self.subnet = subnetOf(address);
+      self.since = clock::now();
+
+      // Declared before the lock, so they are cancelled with _mutex released.
+      bool expired = false;
+      std::optional<scopedTimer> deadline;
+      std::optional<scopedTimer> refill;
+      if (_options.queueTimeout > 0) {
+        deadline.emplace(timerWheel::shared(), std::chrono::milliseconds(_options.queueTimeout), [this, &expired]() {
+          {
+            std::lock_guard<std::mutex> lock(_mutex);
+            expired = true;
+          }
+          _cv.notify_all();
+        });
+      }
+
+      std::unique_lock<std::mutex> lock(_mutex);
+      enqueue(self);
+      dispatch();
+      if (!self.granted) ++_queued;
+
+      while (!self.granted) {
+        if (expired) {
+          leave(self);
+          ++_timedOut;
+          dispatch(); // It may have been the one holding the refill timer
+          lock.unlock();
+          _cv.notify_all();
+          waitedMs = elapsedMs(self.since);
+          return false;
+        }
+
+        // Next in line once tokens refill: this waiter runs the refill timer.
+        if (self.armedMs >= 0) {
+          std::chrono::milliseconds delay(self.armedMs);
+          self.armedMs = -1;
+          lock.unlock();
+          if (refill) refill->reset(delay);
+          else refill.emplace(timerWheel::shared(), delay, [this]() {
+            {
+              std::lock_guard<std::mutex> lock(_mutex);
+              dispatch();
+            }
+            _cv.notify_all();
+          });
+          lock.lock();
+          continue;
+        }
+
+        _cv.wait(lock, [&self, &expired]() { return self.granted || expired || self.armedMs >= 0; });
+      }
+
+      waitedMs = elapsedMs(self.since);
+      _waits.record(waitedMs);
+      _waitMax = std::max(_waitMax, waitedMs);
+
+      ticket._owner = shared_from_this();
+      ticket._host = self.host;
+      ticket._subnet = self.subnet;
+      return true;
+    }
+
+    inline admissionStats stats() const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      admissionStats stats;
+      stats.admitted = _admitted;
+      stats.queued = _queued;
+      stats.timedOut = _timedOut;
+      stats.waiting = _queue.size();
+      stats.active = static_cast<size_t>(_active);
+      stats.waitP50 = _waits.percentile(0.5);
+      stats.waitP99 = _waits.percentile(0.99);
+      stats.waitMax = _waitMax;
+      return stats;
+    }
+
+    inline const admissionOptions& options() const { return _options; }
+
+    // Subnet a host is counted in, "10.1.2.0/24" style.
+    inline std::string subnetOf(const std::string& address) const {
+      unsigned char bytes[16] = {};
+      int family = AF_INET, prefix = _options.subnetPrefix, length = 4;
+      if (inet_pton(AF_INET, address.c_str(), bytes) != 1) {
+        if (inet_pton(AF_INET6, address.c_str(), bytes) != 1) return address;
+        family = AF_INET6;
+        prefix = _options.subnetPrefix6;
+        length = 16;
+      }
+
+      prefix = std::clamp(prefix, 0, length * 8);
+      for (int bit = prefix; bit < length * 8; ++bit) bytes[bit / 8] &= static_cast<unsigned char>(~(0x80 >> (bit % 8)));
+
+      char text[INET6_ADDRSTRLEN] = {};
+      inet_ntop(family, bytes, text, sizeof(text));
+      return std::string(text) + "/" + std::to_string(prefix);
+    }
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    struct tokenBucket {
+      tokenBucket(double rate = 0, double burst = 1)
+        : rate(rate), burst(std::max(burst, 1.0)), tokens(std::max(burst, 1.0)), last(clock::now()) {}
+
+      double rate;
+      double burst;
+      double tokens;
+      clock::time_point last;
+
+      inline void refill(clock::time_point now) {
+        if (rate <= 0) return;
+        tokens = std::min(burst, tokens + std::chrono::duration<double>(now - last).count() * rate);
+        last = now;
+      }
+
+      inline bool ready() const { return rate <= 0 || tokens >= 1.0; }
+      inline void take() { if (rate > 0) tokens -= 1.0; }
+      inline bool full() const { return rate <= 0 || tokens >= burst; }
+
+      // ms until ready(), rounded up.
+      inline int untilReady() const {
+        if (ready()) return 0;
+        return static_cast<int>(std::ceil((1.0 - tokens) / rate * 1000.0));
+      }
+    };
+
+    struct hostState {
+      int active = 0;
+      size_t waiting = 0;
+      uint64_t served = 0;  // Virtual time of the host's last grant
+      tokenBucket bucket;
+    };
+
+    struct waiter {
+      std::string host;
+      std::string subnet;
+      clock::time_point since;
+      bool granted = false;
+      int armedMs = -1;     // >= 0: arm the refill timer for that long
+    };
+
+    admissionOptions _options;
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+
+    std::list<waiter*> _queue; // Arrival order
+    std::unordered_map<std::string, hostState> _hosts;
+    std::unordered_map<std::string, int> _subnets;
+    tokenBucket _global;
+    int _active = 0;
+    uint64_t _round = 0;       // Virtual time, served count of the last grant
+
+    uint64_t _admitted = 0;
+    uint64_t _queued = 0;
+    uint64_t _timedOut = 0;
+    durationHistogram _waits;
+    double _waitMax = 0;
+
+    friend class admissionTicket;
+
+    static inline double elapsedMs(clock::time_point since) {
+      return std::chrono::duration<double, std::milli>(clock::now() - since).count();
+    }
+
+    inline hostState& host(const std::string& address) {
+      auto found = _hosts.find(address);
+      if (found != _hosts.end()) return found->second;
+
+      hostState& state = _hosts[address];
+      state.bucket = tokenBucket(_options.hostConnectRate, _options.hostConnectBurst);
+      return state;
+    }
+
+    inline void enqueue(waiter& self) {
+      hostState& state = host(self.host);
+      // A host that starts waiting joins at the current round, not at its old count.
+      if (state.waiting++ == 0) state.served = std::max(state.served, _round);
+      _queue.push_back(&self);
+    }
+
+    inline void leave(waiter& self) {
+      _queue.remove(&self);
+      hostState& state = host(self.host);
+      --state.waiting;
+      forgetIfIdle(self.host);
+    }
+
+    inline void forgetIfIdle(const std::string& address) {
+      auto found = _hosts.find(address);
+      if (found == _hosts.end()) return;
+      found->second.bucket.refill(clock::now());
+      if (found->second.active == 0 && found->second.waiting == 0 && found->second.bucket.full()) _hosts.erase(found);
+    }
+
+    inline bool subnetFull(const std::string& subnet) const {
+      if (_options.maxPerSubnet <= 0) return false;
+      auto found = _subnets.find(subnet);
+      return found != _subnets.end() && found->second >= _options.maxPerSubnet;
+    }
+
+    // Grants as many waiters as the limits allow, under _mutex. When tokens are all
+    // that is missing, the waiter next in line is told to arm the refill timer.
+    inline void dispatch() {
+      clock::time_point now = clock::now();
+      _global.refill(now);
+
+      while (!_queue.empty()) {
+        if (_options.maxSessions > 0 && _active >= _options.maxSessions) return;
+
+        waiter* best = nullptr;
+        hostState* bestHost = nullptr;
+        waiter* starved = nullptr; // Only missing a host token
+        int starvedMs = 0;
+
+        for (waiter* candidate : _queue) {
+          hostState& state = host(candidate->host);
+          if (_options.maxPerHost > 0 && state.active >= _options.maxPerHost) continue;
+          if (subnetFull(candidate->subnet)) continue;
+
+          state.bucket.refill(now);
+          if (!state.bucket.ready()) {
+            int ms = state.bucket.untilReady();
+            if (!starved || ms < starvedMs) { starved = candidate; starvedMs = ms; }
+            continue;
+          }
+
+          if (!best || state.served < bestHost->served) { best = candidate; bestHost = &state; }
+        }
+
+        if (!best) {
+          if (starved) arm(*starved, starvedMs);
+          return;
+        }
+        if (!_global.ready()) return arm(*best, _global.untilReady());
+
+        _global.take();
+        bestHost->bucket.take();
+        ++bestHost->active;
+        --bestHost->waiting;
+        _round = std::max(_round, bestHost->served);
+        ++bestHost->served;
+        ++_subnets[best->subnet];
+        ++_active;
+        ++_admitted;
+
+        _queue.remove(best);
+        best->granted = true;
+        _cv.notify_all();
+      }
+    }
+
+    inline void arm(waiter& next, int ms) {
+      next.armedMs = std::max(ms, 1);
+      _cv.notify_all();
+    }
+
+    inline void release(const std::string& address, const std::string& subnet) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        --_active;
+        --host(address).active;
+        auto found = _subnets.find(subnet);
+        if (found != _subnets.end() && --found->second <= 0) _subnets.erase(found);
+        forgetIfIdle(address);
+        dispatch();
+      }
+      _cv.notify_all();
+    }
+  };
+
+  inline void admissionTicket::release() {
+    if (!_owner) return;
+    std::shared_ptr<admissionController> owner = std::move(_owner);
+    _owner = nullptr;
+    owner->release(_host, _subnet);
+  }
+
+}
+#endif // RTELNET_ADMISSION_H
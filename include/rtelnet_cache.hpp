@@ -0,0 +1,199 @@
+/*
+* Command result cache shared between sessions.
+*
+* Entries are keyed by (address, port, user, command) and kept in a size bounded
+* LRU. Only commands with a TTL are cached: set a default or per command prefix
+* TTLs for read-only commands ("show version", "show inventory").
+*
+* Identical requests that arrive while one is on the wire wait for its result
+* instead of sending the command again.
+*/
+#ifndef RTELNET_CACHE_H
+#define RTELNET_CACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+inline constexpr size_t RTELNET_CACHE_CAPACITY = 1024; // entries
+
+namespace rtnt {
+
+  class commandCache {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    // Status of a cache hit and the only one cached, same value as RTELNET_SUCCESS
+    // (this header does not depend on rtelnet.hpp).
+    static constexpr unsigned int success = 0;
+
+    struct cacheStats {
+      std::atomic<uint64_t> hits{0};
+      std::atomic<uint64_t> misses{0};
+      std::atomic<uint64_t> coalesced{0}; // Served by a request already in flight
+      std::atomic<uint64_t> evictions{0};
+      std::atomic<uint64_t> expired{0};
+    };
+
+    explicit commandCache(size_t capacity = RTELNET_CACHE_CAPACITY,
+                          std::chrono::milliseconds defaultTtl = std::chrono::milliseconds(0))
+      : _capacity(capacity), _defaultTtl(defaultTtl) {}
+
+    // TTL for every command starting with `prefix`, the longest matching prefix wins.
+    inline void setTtl(const std::string& prefix, std::chrono::milliseconds ttl) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _ttls[prefix] = ttl;
+    }
+
+    inline std::chrono::milliseconds ttlFor(const std::string& command) const {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      std::chrono::milliseconds ttl = _defaultTtl;
+      size_t matched = 0;
+      for (const auto& [prefix, value] : _ttls) {
+        if (prefix.size() >= matched && command.compare(0, prefix.size(), prefix) == 0) {
+          ttl = value;
+          matched = prefix.size();
+        }
+      }
+      return ttl;
+    }
+
+    static inline std::string makeKey(const std::string& address, int port, const std::string& user, const std::string& command) {
+      std::string key;
+      key.reserve(address.size() + user.size() + command.size() + 16);
+      key.append(address).push_back('\0');
+      key.append(std::to_string(port)).push_back('\0');
+      key.append(user).push_back('\0');
+      key.append(command);
+      return key;
+    }
+
+    // Returns the cached output, joins an identical request in flight, or runs
+    // `produce` and caches its output when it succeeds. A request that joined gets
+    // the status of the one it joined, failures included, or its exception.
+    unsigned int fetch(const std::string& key, std::chrono::milliseconds ttl,
+                       const std::function<unsigned int(std::string&)>& produce, std::string& out) {
+      std::shared_future<result> waiting;
+      std::promise<result> producing;
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto found = _index.find(key);
+        if (found != _index.end()) {
+          if (clock::now() < found->second->expires) {
+            _lru.splice(_lru.begin(), _lru, found->second);
+            out = found->second->output;
+            ++_stats.hits;
+            return success;
+          }
+          _lru.erase(found->second);
+          _index.erase(found);
+          ++_stats.expired;
+        }
+
+        auto inflight = _inflight.find(key);
+        if (inflight != _inflight.end()) {
+          waiting = inflight->second;
+          ++_stats.coalesced;
+        } else {
+          _inflight.emplace(key, producing.get_future().share());
+          ++_stats.misses;
+        }
+      }
+
+      if (waiting.valid()) {
+        const result& shared = waiting.get();
+        out = shared.output;
+        return shared.status;
+      }
+
+      result produced;
+      try {
+        produced.status = produce(produced.output);
+      } catch (...) {
+        // Joined requests must not wait forever, they rethrow the same exception.
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _inflight.erase(key);
+        }
+        producing.set_exception(std::current_exception());
+        throw;
+      }
+      out = produced.output;
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (produced.status == success && ttl.count() > 0 && _capacity > 0) store(key, produced.output, ttl);
+        _inflight.erase(key);
+      }
+
+      unsigned int status = produced.status;
+      producing.set_value(std::move(produced));
+      return status;
+    }
+
+    inline void clear() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _lru.clear();
+      _index.clear();
+    }
+
+    inline size_t size() const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _lru.size();
+    }
+
+    inline const cacheStats& stats() const { return _stats; }
+
+  private:
+    struct result {
+      unsigned int status = success;
+      std::string output;
+    };
+
+    struct entry {
+      std::string key;
+      std::string output;
+      clock::time_point expires;
+    };
+
+    const size_t _capacity;
+    const std::chrono::milliseconds _defaultTtl;
+    mutable std::mutex _mutex;
+    std::map<std::string, std::chrono::milliseconds> _ttls;
+    std::list<entry> _lru; // Most recently used first
+    std::unordered_map<std::string, std::list<entry>::iterator> _index;
+    std::unordered_map<std::string, std::shared_future<result>> _inflight;
+    cacheStats _stats;
+
+    inline void store(const std::string& key, const std::string& output, std::chrono::milliseconds ttl) {
+      auto found = _index.find(key);
+      if (found != _index.end()) {
+        _lru.erase(found->second);
+        _index.erase(found);
+      }
+
+      _lru.push_front(entry{key, output, clock::now() + ttl});
+      _index[key] = _lru.begin();
+
+      while (_lru.size() > _capacity) {
+        _index.erase(_lru.back().key);
+        _lru.pop_back();
+        ++_stats.evictions;
+      }
+    }
+  };
+
+}
+#endif // RTELNET_CACHE_H
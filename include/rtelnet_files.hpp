@@ -0,0 +1,42 @@
+/*
+* Small files the library persists between runs (learned profiles).
+*
+* writeAtomically() writes to `<path>.tmp.<pid>` and renames it over `path`, so a
+* reader never sees a half written file. The temporary file is removed whenever
+* the write, the flush or the rename fails.
+*/
+#ifndef RTELNET_FILES_H
+#define RTELNET_FILES_H
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <unistd.h>
+
+namespace rtnt {
+
+  inline bool writeAtomically(const std::string& path, const std::function<void(std::ostream&)>& write) {
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+    {
+      std::ofstream file(temporary, std::ios::trunc);
+      if (!file) return false;
+
+      write(file);
+      if (!file.flush()) {
+        file.close();
+        std::remove(temporary.c_str());
+        return false;
+      }
+    }
+
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+    return true;
+  }
+
+}
+#endif // RTELNET_FILES_H
@@ -0,0 +1,614 @@
+/*
+* relic-telnetd gateway protocol and client.
+*
+* The daemon keeps logged-in sessions open and serves them to local processes
+* over a Unix domain socket, so short lived scripts share connections instead of
+* each one logging in (and taking a VTY line) again.
+*
+* Frames are in native byte order, the socket is local only.
+*
+* Request:  requestHeader, then the payload:
+*             string address, u32 port, string username, string password, string command
+*             EXPECT adds: string expected, u32 timeout (ms)
+* Response: responseHeader, then `length` bytes of output.
+*             EXECUTE and EXPECT answer with a single RESULT frame.
+*             STREAM answers with CHUNK frames as output arrives, then an empty RESULT.
+*
+* Strings are a u32 length followed by the bytes. Status codes are the session's
+* (Errors, errno values or RTELNET_SUCCESS).
+*
+* gatewayServer is the daemon side (src/rtelnetd.cpp wraps it), gatewayClient the
+* client side.
+*/
+#ifndef RTELNET_GATEWAY_H
+#define RTELNET_GATEWAY_H
+
+#include "rtelnet.hpp"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+inline constexpr const char* RTELNET_GATEWAY_SOCKET       = "relic-telnetd.sock"; // File name, see gatewaySocketPath()
+inline constexpr uint32_t    RTELNET_GATEWAY_MAX_FRAME    = 64 << 20; // Payload bytes per frame
+inline constexpr size_t      RTELNET_GATEWAY_MAX_SESSIONS = 256;
+inline constexpr int         RTELNET_GATEWAY_SESSION_TTL  = 300000; // ms a pooled session may sit unused
+
+namespace rtnt {
+
+  enum class GatewayOp : uint8_t {
+    EXECUTE = 1, // Output of one command
+    STREAM  = 2, // Output of one command, chunk by chunk as it arrives
+    EXPECT  = 3  // Output of one command up to an expected string
+  };
+
+  enum class GatewayFrame : uint8_t {
+    RESULT = 0, // Final frame of a request, carries the status
+    CHUNK  = 1  // Partial STREAM output
+  };
+
+  struct gatewayRequestHeader {
+    uint32_t length = 0; // Payload bytes after the header
+    uint32_t id = 0;     // Echoed back in every response frame
+    GatewayOp op = GatewayOp::EXECUTE;
+    uint8_t reserved[3] = {};
+  };
+
+  struct gatewayResponseHeader {
+    uint32_t length = 0;
+    uint32_t id = 0;
+    uint32_t status = RTELNET_SUCCESS;
+    GatewayFrame kind = GatewayFrame::RESULT;
+    uint8_t reserved[3] = {};
+  };
+
+  // Which device session a request runs on.
+  struct gatewayTarget {
+    std::string address;
+    int port = RTELNET_PORT;
+    std::string username;
+    std::string password;
+  };
+
+  // $XDG_RUNTIME_DIR/relic-telnetd.sock, private to the user by definition, else the
+  // socket in an owner only directory per user under /tmp, which Listen() creates.
+  inline std::string gatewaySocketPath() {
+    const char* runtime = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime && runtime[0] == '/') return std::string(runtime) + "/" + RTELNET_GATEWAY_SOCKET;
+    return "/tmp/relic-telnetd-" + std::to_string(geteuid()) + "/" + RTELNET_GATEWAY_SOCKET;
+  }
+
+  namespace gatewayWire {
+
+    inline bool writeAll(int fd, const void* data, size_t size) {
+      const char* bytes = static_cast<const char*>(data);
+      while (size > 0) {
+        ssize_t wrote = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (wrote < 0 && errno == EINTR) continue;
+        if (wrote <= 0) return false;
+        bytes += wrote;
+        size -= static_cast<size_t>(wrote);
+      }
+      return true;
+    }
+
+    inline bool readAll(int fd, void* data, size_t size) {
+      char* bytes = static_cast<char*>(data);
+      while (size > 0) {
+        ssize_t got = recv(fd, bytes, size, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        bytes += got;
+        size -= static_cast<size_t>(got);
+      }
+      return true;
+    }
+
+    inline void putU32(std::string& out, uint32_t value) {
+      out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    inline void putString(std::string& out, std::string_view value) {
+      putU32(out, static_cast<uint32_t>(value.size()));
+      out.append(value.data(), value.size());
+    }
+
+    // Reads fields off a payload, every getter fails once the payload is exhausted.
+    class reader {
+    public:
+      explicit reader(std::string_view payload) : _payload(payload) {}
+
+      inline bool getU32(uint32_t& value) {
+        if (_payload.size() < sizeof(value)) return false;
+        std::memcpy(&value, _payload.data(), sizeof(value));
+        _payload.remove_prefix(sizeof(value));
+        return true;
+      }
+
+      inline bool getString(std::string& value) {
+        uint32_t size = 0;
+        if (!getU32(size) || _payload.size() < size) return false;
+        value.assign(_payload.data(), size);
+        _payload.remove_prefix(size);
+        return true;
+      }
+
+    private:
+      std::string_view _payload;
+    };
+
+    inline bool writeResponse(int fd, uint32_t id, uint32_t status, GatewayFrame kind, std::string_view output) {
+      gatewayResponseHeader header;
+      header.length = static_cast<uint32_t>(output.size());
+      header.id = id;
+      header.status = status;
+      header.kind = kind;
+      return writeAll(fd, &header, sizeof(header)) && writeAll(fd, output.data(), output.size());
+    }
+
+  }
+
+  // Thin client for relic-telnetd. One request at a time per client, open one
+  // client per thread for parallel requests.
+  class gatewayClient {
+  public:
+    explicit gatewayClient(std::string path = gatewaySocketPath()) : _path(std::move(path)) {}
+
+    ~gatewayClient() { Close(); }
+
+    gatewayClient(const gatewayClient&) = delete;
+    gatewayClient& operator=(const gatewayClient&) = delete;
+
+    inline unsigned int Connect() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return connectLocked();
+    }
+
+    inline void Close() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      closeLocked();
+    }
+
+    unsigned int Execute(const gatewayTarget& target, const std::string& command, std::string& buffer) {
+      std::string payload = encodeTarget(target, command);
+      return request(GatewayOp::EXECUTE, payload, [&buffer](std::string_view chunk) { buffer.append(chunk); }, buffer);
+    }
+
+    // `onChunk` is called as output arrives on the device.
+    unsigned int Stream(const gatewayTarget& target, const std::string& command,
+                        const std::function<void(std::string_view)>& onChunk) {
+      std::string unused;
+      return request(GatewayOp::STREAM, encodeTarget(target, command), onChunk, unused);
+    }
+
+    unsigned int Expect(const gatewayTarget& target, const std::string& command, const std::string& expected,
+                        std::string& buffer, int timeoutMs = RTELNET_EXPECT_TIMEOUT) {
+      std::string payload = encodeTarget(target, command);
+      gatewayWire::putString(payload, expected);
+      gatewayWire::putU32(payload, static_cast<uint32_t>(timeoutMs));
+      return request(GatewayOp::EXPECT, payload, [&buffer](std::string_view chunk) { buffer.append(chunk); }, buffer);
+    }
+
+  private:
+    std::string _path;
+    std::mutex _mutex;
+    int _fd = -1;
+    uint32_t _nextId = 1;
+
+    inline unsigned int connectLocked() {
+      if (_fd >= 0) return RTELNET_SUCCESS;
+
+      sockaddr_un address{};
+      address.sun_family = AF_UNIX;
+      if (_path.size() >= sizeof(address.sun_path)) return Errors::ADDRESS_NOT_VALID;
+      std::memcpy(address.sun_path, _path.c_str(), _path.size() + 1);
+
+      _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (_fd < 0) return Errors::CANNOT_ALLOCATE_FD;
+
+      if (connect(_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        closeLocked();
+        return Errors::GATEWAY_UNAVAILABLE;
+      }
+      return RTELNET_SUCCESS;
+    }
+
+    inline void closeLocked() {
+      if (_fd >= 0) close(_fd);
+      _fd = -1;
+    }
+
+    static std::string encodeTarget(const gatewayTarget& target, const std::string& command) {
+      std::string payload;
+      payload.reserve(target.address.size() + target.username.size() + target.password.size() + command.size() + 32);
+      gatewayWire::putString(payload, target.address);
+      gatewayWire::putU32(payload, static_cast<uint32_t>(target.port));
+      gatewayWire::putString(payload, target.username);
+      gatewayWire::putString(payload, target.password);
+      gatewayWire::putString(payload, command);
+      return payload;
+    }
+
+    // Sends one request and reads frames until its RESULT. A broken connection
+    // is dropped and reopened on the next request.
+    unsigned int request(GatewayOp op, const std::string& payload,
+                         const std::function<void(std::string_view)>& onChunk, std::string& buffer) {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      unsigned int connectStatus = connectLocked();
+      if (connectStatus != RTELNET_SUCCESS) return connectStatus;
+
+      buffer.clear();
+
+      gatewayRequestHeader header;
+      header.length = static_cast<uint32_t>(payload.size());
+      header.id = _nextId++;
+      header.op = op;
+
+      if (!gatewayWire::writeAll(_fd, &header, sizeof(header)) || !gatewayWire::writeAll(_fd, payload.data(), payload.size())) {
+        closeLocked();
+        return Errors::GATEWAY_UNAVAILABLE;
+      }
+
+      std::string frame;
+      while (true) {
+        gatewayResponseHeader response;
+        if (!gatewayWire::readAll(_fd, &response, sizeof(response))) {
+          closeLocked();
+          return Errors::GATEWAY_UNAVAILABLE;
+        }
+        if (response.id != header.id || response.length > RTELNET_GATEWAY_MAX_FRAME) {
+          closeLocked();
+          return Errors::GATEWAY_PROTOCOL;
+        }
+
+        frame.resize(response.length);
+        if (!gatewayWire::readAll(_fd, frame.data(), frame.size())) {
+          closeLocked();
+          return Errors::GATEWAY_UNAVAILABLE;
+        }
+
+        if (!frame.empty()) onChunk(frame);
+        if (response.kind == GatewayFrame::RESULT) return response.status;
+      }
+    }
+  };
+
+  // Daemon side: pools one logged-in session per target and serves every client
+  // connection on its own thread. Requests on a shared session run one at a time.
+  // The pool holds at most `maxSessions`, a session unused for `sessionTtl` ms is
+  // logged out and dropped.
+  class gatewayServer {
+  public:
+    explicit gatewayServer(std::string path = gatewaySocketPath(), int idle = RTELNET_IDLE_TIMEOUT,
+                           int debug = RTELNET_DEBUG, size_t maxSessions = RTELNET_GATEWAY_MAX_SESSIONS,
+                           int sessionTtl = RTELNET_GATEWAY_SESSION_TTL)
+      : _path(std::move(path)), _idle(idle), _debug(debug), _maxSessions(std::max<size_t>(maxSessions, 1)),
+        _sessionTtl(std::max(sessionTtl, 1)) {}
+
+    ~gatewayServer() { Stop(); }
+
+    gatewayServer(const gatewayServer&) = delete;
+    gatewayServer& operator=(const gatewayServer&) = delete;
+
+    // Binds the socket (owner only) and starts accepting and evicting in the background.
+    unsigned int Listen() {
+      sockaddr_un address{};
+      address.sun_family = AF_UNIX;
+      if (_path.size() >= sizeof(address.sun_path)) return Errors::ADDRESS_NOT_VALID;
+      std::memcpy(address.sun_path, _path.c_str(), _path.size() + 1);
+
+      size_t slash = _path.find_last_of('/');
+      if (slash != std::string::npos) {
+        unsigned int directoryStatus = secureDirectory(slash == 0 ? "/" : _path.substr(0, slash));
+        if (directoryStatus != RTELNET_SUCCESS) return directoryStatus;
+      }
+
+      _listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (_listenFd < 0) return Errors::CANNOT_ALLOCATE_FD;
+
+      unlink(_path.c_str());
+
+      // bind() creates the file with the socket's own mode, so it comes out owner
+      // only without a chmod window and without touching the process wide umask.
+      if (fchmod(_listenFd, S_IRUSR | S_IWUSR) < 0 ||
+          bind(_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+          listen(_listenFd, SOMAXCONN) < 0) {
+        int error = errno;
+        close(_listenFd);
+        _listenFd = -1;
+        return error;
+      }
+
+      _acceptor = std::thread([this]() { acceptLoop(); });
+      _evictor = std::thread([this]() { evictLoop(); });
+      return RTELNET_SUCCESS;
+    }
+
+    // Stops accepting, waits for in flight requests and closes every pooled session.
+    void Stop() {
+      if (_stop.exchange(true)) return;
+
+      if (_listenFd >= 0) shutdown(_listenFd, SHUT_RDWR);
+      if (_acceptor.joinable()) _acceptor.join();
+      {
+        std::lock_guard<std::mutex> lock(_poolMutex);
+        _evictCv.notify_all();
+      }
+      if (_evictor.joinable()) _evictor.join();
+      if (_listenFd >= 0) {
+        close(_listenFd);
+        unlink(_path.c_str());
+        _listenFd = -1;
+      }
+
+      {
+        std::unique_lock<std::mutex> lock(_clientsMutex);
+        for (int fd : _clientFds) shutdown(fd, SHUT_RDWR);
+        _clientsCv.wait(lock, [this]() { return _clientFds.empty(); });
+      }
+
+      std::unordered_map<std::string, std::shared_ptr<pooledSession>> closing;
+      {
+        std::lock_guard<std::mutex> lock(_poolMutex);
+        closing.swap(_pool);
+      }
+    }
+
+    inline size_t sessions() const {
+      std::lock_guard<std::mutex> lock(_poolMutex);
+      return _pool.size();
+    }
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    // One device session shared by every client asking for the same target.
+    struct pooledSession {
+      std::string address; // The session keeps a pointer to it
+      std::unique_ptr<session> telnet;
+      std::mutex useMutex; // Held across the reconnect and the request, Reconnect() must not race a command
+      int users = 0;       // Requests holding or waiting for it, under _poolMutex
+      clock::time_point lastUsed = clock::now(); // Under _poolMutex
+    };
+
+    std::string _path;
+    int _idle;
+    int _debug;
+    size_t _maxSessions;
+    int _sessionTtl;
+    int _listenFd = -1;
+    std::atomic<bool> _stop{false};
+    std::thread _acceptor;
+    std::thread _evictor;
+    std::condition_variable _evictCv; // Waits on _poolMutex
+
+    std::mutex _clientsMutex;
+    std::condition_variable _clientsCv;
+    std::set<int> _clientFds;
+
+    mutable std::mutex _poolMutex;
+    std::unordered_map<std::string, std::shared_ptr<pooledSession>> _pool;
+    const std::string _keySalt = std::to_string(std::random_device{}()) + std::to_string(std::random_device{}());
+
+    // Creates a missing socket directory owner only. An existing one must belong to
+    // us or root, and be sticky (like /tmp) when others may write to it, so nobody
+    // else can swap the socket under the clients.
+    static unsigned int secureDirectory(const std::string& directory) {
+      if (mkdir(directory.c_str(), S_IRWXU) == 0) return RTELNET_SUCCESS;
+      if (errno != EEXIST) return errno;
+
+      struct stat info{};
+      if (lstat(directory.c_str(), &info) < 0) return errno;
+      if (!S_ISDIR(info.st_mode)) return ENOTDIR;
+      if (info.st_uid != geteuid() && info.st_uid != 0) return EPERM;
+      if ((info.st_mode & (S_IWGRP | S_IWOTH)) && !(info.st_mode & S_ISVTX)) return EPERM;
+      return RTELNET_SUCCESS;
+    }
+
+    void acceptLoop() {
+      while (!_stop) {
+        int fd = accept(_listenFd, nullptr, nullptr);
+        if (fd < 0) {
+          if (_stop) return;
+          continue;
+        }
+
+        std::lock_guard<std::mutex> lock(_clientsMutex);
+        _clientFds.insert(fd);
+        std::thread([this, fd]() { serve(fd); }).detach();
+      }
+    }
+
+    void serve(int fd) {
+      std::string payload;
+
+      while (!_stop) {
+        gatewayRequestHeader header;
+        if (!gatewayWire::readAll(fd, &header, sizeof(header))) break;
+        if (header.length > RTELNET_GATEWAY_MAX_FRAME) break;
+
+        payload.resize(header.length);
+        if (!gatewayWire::readAll(fd, payload.data(), payload.size())) break;
+
+        if (!handle(fd, header, payload)) break;
+      }
+
+      std::lock_guard<std::mutex> lock(_clientsMutex);
+      _clientFds.erase(fd);
+      close(fd);
+      _clientsCv.notify_all();
+    }
+
+    // False once the client can no longer be answered.
+    bool handle(int fd, const gatewayRequestHeader& header, const std::string& payload) {
+      gatewayWire::reader fields(payload);
+      gatewayTarget target;
+      std::string command, expected;
+      uint32_t port = 0, timeout = RTELNET_EXPECT_TIMEOUT;
+
+      bool valid = fields.getString(target.address) && fields.getU32(port) &&
+                   fields.getString(target.username) && fields.getString(target.password) &&
+                   fields.getString(command);
+      if (valid && header.op == GatewayOp::EXPECT) valid = fields.getString(expected) && fields.getU32(timeout);
+
+      if (!valid) {
+        gatewayWire::writeResponse(fd, header.id, Errors::GATEWAY_PROTOCOL, GatewayFrame::RESULT, {});
+        return false;
+      }
+      target.port = static_cast<int>(port);
+
+      std::string output;
+      bool clientGone = false;
+      auto run = [&](session& telnet) -> unsigned int {
+        switch (header.op) {
+          case GatewayOp::EXECUTE:
+            return telnet.Execute(command, output);
+
+          case GatewayOp::EXPECT:
+            return telnet.Expect(command, expected, output, static_cast<int>(timeout));
+
+          case GatewayOp::STREAM:
+            return telnet.Stream(command, [&](const char* data, size_t size) {
+              if (gatewayWire::writeResponse(fd, header.id, RTELNET_SUCCESS, GatewayFrame::CHUNK, std::string_view(data, size))) return 0;
+              clientGone = true;
+              return EPIPE;
+            });
+        }
+        return static_cast<unsigned int>(Errors::GATEWAY_PROTOCOL);
+      };
+
+      // A session the device dropped since its last use is reconnected once.
+      unsigned int status = RTELNET_SUCCESS;
+      for (int attempt = 0; attempt < 2; ++attempt) {
+        std::shared_ptr<pooledSession> pooled = acquire(target, status);
+        if (!pooled) break;
+
+        {
+          std::lock_guard<std::mutex> use(pooled->useMutex);
+          status = login(*pooled);
+          if (status == RTELNET_SUCCESS) status = run(*pooled->telnet);
+        }
+        release(pooled);
+
+        if (status != Errors::SESSION_DEAD || header.op == GatewayOp::STREAM) break;
+      }
+
+      if (clientGone) return false;
+      return sendOutput(fd, header.id, status, output);
+    }
+
+    // The target's pooled session, created on first use and counted as in use until
+    // release(). A full pool makes room by dropping its least recently used idle
+    // session, null with GATEWAY_POOL_FULL when every session is busy.
+    std::shared_ptr<pooledSession> acquire(const gatewayTarget& target, unsigned int& status) {
+      // The password only as a salted hash: the key never holds it in the clear, and a
+      // request with another password still gets a session of its own.
+      std::string credentials = std::to_string(std::hash<std::string>{}(_keySalt + target.password));
+      std::string key = commandCache::makeKey(target.address, target.port, target.username, credentials);
+
+      std::shared_ptr<pooledSession> evicted; // Logged out once the pool is unlocked
+      std::lock_guard<std::mutex> lock(_poolMutex);
+
+      auto found = _pool.find(key);
+      if (found == _pool.end()) {
+        if (_pool.size() >= _maxSessions) {
+          auto oldest = _pool.end();
+          for (auto entry = _pool.begin(); entry != _pool.end(); ++entry) {
+            if (entry->second->users > 0) continue;
+            if (oldest == _pool.end() || entry->second->lastUsed < oldest->second->lastUsed) oldest = entry;
+          }
+          if (oldest == _pool.end()) {
+            status = Errors::GATEWAY_POOL_FULL;
+            return nullptr;
+          }
+          evicted = std::move(oldest->second);
+          _pool.erase(oldest);
+        }
+
+        auto slot = std::make_shared<pooledSession>();
+        slot->address = target.address;
+        slot->telnet = std::make_unique<session>(slot->address.c_str(), target.username, target.password,
+                                                 target.port, RTELNET_IP_VERSION, _debug, _idle);
+        // Replies held back by delayed ACKs would land in the next caller's idle window.
+        slot->telnet->_transport.noDelay = true;
+        slot->telnet->_transport.quickAck = true;
+        found = _pool.emplace(key, std::move(slot)).first;
+      }
+
+      ++found->second->users;
+      status = RTELNET_SUCCESS;
+      return found->second;
+    }
+
+    inline void release(const std::shared_ptr<pooledSession>& pooled) {
+      std::lock_guard<std::mutex> lock(_poolMutex);
+      --pooled->users;
+      pooled->lastUsed = clock::now();
+    }
+
+    // Logs in on first use, and again whenever the session is no longer usable.
+    // Called with useMutex held.
+    static unsigned int login(pooledSession& pooled) {
+      if (pooled.telnet->isAlive() && pooled.telnet->isLoggedIn()) return RTELNET_SUCCESS;
+
+      unsigned int status = pooled.telnet->Reconnect();
+      if (status == RTELNET_SUCCESS) status = pooled.telnet->FlushBanner();
+      return status;
+    }
+
+    // Drops sessions nobody used for _sessionTtl, checking a few times per TTL.
+    void evictLoop() {
+      std::chrono::milliseconds ttl(_sessionTtl);
+      std::unique_lock<std::mutex> lock(_poolMutex);
+
+      while (!_stop) {
+        _evictCv.wait_for(lock, std::max(ttl / 4, std::chrono::milliseconds(1)));
+        if (_stop) break;
+
+        std::vector<std::shared_ptr<pooledSession>> expired;
+        clock::time_point now = clock::now();
+        for (auto entry = _pool.begin(); entry != _pool.end();) {
+          if (entry->second->users == 0 && now - entry->second->lastUsed >= ttl) {
+            expired.push_back(std::move(entry->second));
+            entry = _pool.erase(entry);
+          } else {
+            ++entry;
+          }
+        }
+
+        // Logging out waits on the device, not with the pool locked.
+        lock.unlock();
+        expired.clear();
+        lock.lock();
+      }
+    }
+
+    // Outputs past the frame limit go out as CHUNK frames ahead of the RESULT.
+    static bool sendOutput(int fd, uint32_t id, unsigned int status, std::string_view output) {
+      while (output.size() > RTELNET_GATEWAY_MAX_FRAME) {
+        if (!gatewayWire::writeResponse(fd, id, RTELNET_SUCCESS, GatewayFrame::CHUNK, output.substr(0, RTELNET_GATEWAY_MAX_FRAME))) return false;
+        output.remove_prefix(RTELNET_GATEWAY_MAX_FRAME);
+      }
+      return gatewayWire::writeResponse(fd, id, status, GatewayFrame::RESULT, output);
+    }
+  };
+
+}
+#endif // RTELNET_GATEWAY_H
@@ -0,0 +1,119 @@
+/*
+* Option negotiation remembered per host.
+*
+* A telnet server opens with the same DO/WILL requests on every connection. Once
+* a host was seen, Connect() sends our answers to its requests right after the
+* socket connects instead of waiting for them, which saves a round trip on every
+* reconnect. The requests of the last successful connection replace the stored
+* ones, so a host that changed its options is relearned on the next connect.
+*
+* Profiles can be shared by every session of a process and persisted to a small
+* text file between runs.
+*/
+#ifndef RTELNET_NEGOTIATION_H
+#define RTELNET_NEGOTIATION_H
+
+#include "rtelnet_files.hpp"
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rtnt {
+
+  // (command, option) pairs as the server sent them, e.g. (DO, TERMINAL_TYPE).
+  using optionRequests = std::vector<std::pair<unsigned char, unsigned char>>;
+
+  // Requests by host, optionally loaded from and saved to `path`.
+  //
+  // File format, one host per line:
+  //   <address>:<port> <command>,<option> <command>,<option> ...
+  class negotiationProfiles {
+  public:
+    explicit negotiationProfiles(std::string path = "") : _path(std::move(path)) {
+      if (!_path.empty()) load();
+    }
+
+    ~negotiationProfiles() {
+      if (!_path.empty()) save();
+    }
+
+    negotiationProfiles(const negotiationProfiles&) = delete;
+    negotiationProfiles& operator=(const negotiationProfiles&) = delete;
+
+    // Empty when the host was never seen.
+    inline optionRequests requestsFor(const std::string& address, int port) const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      auto found = _requests.find(key(address, port));
+      return (found != _requests.end()) ? found->second : optionRequests();
+    }
+
+    inline void store(const std::string& address, int port, optionRequests requests) {
+      if (requests.empty()) return;
+      std::lock_guard<std::mutex> lock(_mutex);
+      _requests[key(address, port)] = std::move(requests);
+    }
+
+    inline void forget(const std::string& address, int port) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _requests.erase(key(address, port));
+    }
+
+    inline size_t size() const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _requests.size();
+    }
+
+    // Missing or unreadable lines are skipped, a bad file only costs a round trip.
+    inline bool load() {
+      std::ifstream file(_path);
+      if (!file) return false;
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::string line;
+      while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string host;
+        if (!(fields >> host)) continue;
+
+        optionRequests requests;
+        unsigned int command = 0, option = 0;
+        char comma = 0;
+        while (fields >> command >> comma >> option) {
+          if (comma != ',' || command > 255 || option > 255) break;
+          requests.emplace_back(static_cast<unsigned char>(command), static_cast<unsigned char>(option));
+        }
+        if (!requests.empty()) _requests[host] = std::move(requests);
+      }
+      return true;
+    }
+
+    // Same temporary and rename dance as idleProfiles::save().
+    inline bool save() const {
+      return writeAtomically(_path, [this](std::ostream& file) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const auto& [host, requests] : _requests) {
+          file << host;
+          for (const auto& [command, option] : requests) {
+            file << ' ' << static_cast<unsigned int>(command) << ',' << static_cast<unsigned int>(option);
+          }
+          file << '\n';
+        }
+      });
+    }
+
+  private:
+    std::string _path;
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, optionRequests> _requests;
+
+    static inline std::string key(const std::string& address, int port) {
+      return address + ":" + std::to_string(port);
+    }
+  };
+
+}
+#endif // RTELNET_NEGOTIATION_H
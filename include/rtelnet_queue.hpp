@@ -0,0 +1,96 @@
+/*
+* Intrusive multi producer / single consumer queue (Vyukov).
+*
+* push() is lock free and wait free for producers (one atomic exchange),
+* pop() must only be called from a single consumer thread.
+*/
+#ifndef RTELNET_QUEUE_H
+#define RTELNET_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace rtnt {
+
+  template <typename T>
+  class mpscQueue {
+  public:
+    mpscQueue() : _head(&_stub), _tail(&_stub) {}
+
+    ~mpscQueue() {
+      T value;
+      while (pop(value)) {}
+    }
+
+    mpscQueue(const mpscQueue&) = delete;
+    mpscQueue& operator=(const mpscQueue&) = delete;
+
+    inline void push(T value) {
+      node* entry = new node(std::move(value));
+      _size.fetch_add(1, std::memory_order_relaxed);
+      enqueue(entry);
+    }
+
+    // False when empty, or when a producer is between its exchange and its link
+    // (size() is already non zero then, the consumer simply retries).
+    inline bool pop(T& out) {
+      node* tail = _tail;
+      node* next = tail->next.load(std::memory_order_acquire);
+
+      if (tail == &_stub) {
+        if (next == nullptr) return false;
+        _tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+
+      if (next != nullptr) {
+        _tail = next;
+        return take(tail, out);
+      }
+
+      if (tail != _head.load(std::memory_order_acquire)) return false;
+
+      // Last real node, put the stub behind it so it can be released.
+      _stub.next.store(nullptr, std::memory_order_relaxed);
+      enqueue(&_stub);
+
+      next = tail->next.load(std::memory_order_acquire);
+      if (next == nullptr) return false;
+
+      _tail = next;
+      return take(tail, out);
+    }
+
+    inline size_t size() const { return _size.load(std::memory_order_acquire); }
+
+  private:
+    struct node {
+      node() = default;
+      explicit node(T&& data) : value(std::move(data)) {}
+
+      std::atomic<node*> next{nullptr};
+      T value{};
+    };
+
+    node _stub;
+    std::atomic<node*> _head;
+    node* _tail;
+    std::atomic<size_t> _size{0};
+
+    inline void enqueue(node* entry) {
+      node* previous = _head.exchange(entry, std::memory_order_acq_rel);
+      previous->next.store(entry, std::memory_order_release);
+    }
+
+    inline bool take(node* entry, T& out) {
+      out = std::move(entry->value);
+      delete entry;
+      _size.fetch_sub(1, std::memory_order_release);
+      return true;
+    }
+  };
+
+}
+#endif // RTELNET_QUEUE_H
@@ -0,0 +1,176 @@
+/*
+* Command output that spills to disk past a memory threshold.
+*
+* Below the threshold output is kept in memory. Past it, everything is moved to
+* an unlinked temp file and appended in RTELNET_SPILL_CHUNK sized writes, once the
+* command is done the file is mapped read-only. Either way view() hands back the
+* whole output as a string_view, resident memory stays bounded by the threshold.
+*
+* Status codes are errno values (0 on success), like the tcp layer.
+*/
+#ifndef RTELNET_SPILL_H
+#define RTELNET_SPILL_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+
+inline constexpr size_t RTELNET_SPILL_THRESHOLD = 8 * 1024 * 1024; // bytes kept in memory
+inline constexpr size_t RTELNET_SPILL_CHUNK     = 1024 * 1024;     // bytes per write() once spilled
+
+namespace rtnt {
+
+  class spillBuffer {
+  public:
+    // `directory` defaults to $TMPDIR, then /tmp.
+    explicit spillBuffer(size_t threshold = RTELNET_SPILL_THRESHOLD, std::string directory = "")
+      : _threshold(threshold), _directory(std::move(directory)) {}
+
+    ~spillBuffer() { release(); }
+
+    spillBuffer(const spillBuffer&) = delete;
+    spillBuffer& operator=(const spillBuffer&) = delete;
+
+    spillBuffer(spillBuffer&& other) noexcept { *this = std::move(other); }
+
+    spillBuffer& operator=(spillBuffer&& other) noexcept {
+      if (this == &other) return *this;
+      release();
+      _threshold = other._threshold;
+      _directory = std::move(other._directory);
+      _memory = std::move(other._memory);
+      _fd = std::exchange(other._fd, -1);
+      _written = std::exchange(other._written, 0);
+      _mapped = std::exchange(other._mapped, nullptr);
+      _mappedSize = std::exchange(other._mappedSize, 0);
+      _spilled = std::exchange(other._spilled, false);
+      return *this;
+    }
+
+    // Drops previous output, keeps the threshold and directory.
+    inline void clear() {
+      release();
+      _memory.clear();
+      _memory.shrink_to_fit();
+    }
+
+    inline int append(const char* data, size_t size) {
+      if (_mapped != nullptr) return EBUSY;
+
+      if (!_spilled) {
+        if (_memory.size() + size <= _threshold) {
+          _memory.append(data, size);
+          return 0;
+        }
+
+        int status = spill();
+        if (status != 0) return status;
+      }
+
+      _memory.append(data, size);
+      return (_memory.size() >= RTELNET_SPILL_CHUNK) ? flush() : 0;
+    }
+
+    // Flushes and maps the file, call once the output is complete.
+    inline int finish() {
+      if (!_spilled || _mapped != nullptr) return 0;
+
+      int status = flush();
+      if (status != 0) return status;
+
+      _memory.shrink_to_fit();
+      if (_written == 0) return 0;
+
+      void* mapped = mmap(nullptr, _written, PROT_READ, MAP_PRIVATE, _fd, 0);
+      if (mapped == MAP_FAILED) return errno;
+
+      madvise(mapped, _written, MADV_SEQUENTIAL);
+      _mapped = static_cast<const char*>(mapped);
+      _mappedSize = _written;
+
+      // The mapping keeps the (already unlinked) file alive.
+      close(_fd);
+      _fd = -1;
+      return 0;
+    }
+
+    inline std::string_view view() const {
+      if (_mapped != nullptr) return std::string_view(_mapped, _mappedSize);
+      return std::string_view(_memory);
+    }
+
+    inline size_t size() const { return _spilled ? _written + _memory.size() : _memory.size(); }
+    inline bool spilled() const { return _spilled; }
+    inline size_t threshold() const { return _threshold; }
+
+  private:
+    size_t _threshold = RTELNET_SPILL_THRESHOLD;
+    std::string _directory;
+    std::string _memory; // Whole output before spilling, the pending write after
+    int _fd = -1;
+    size_t _written = 0;
+    const char* _mapped = nullptr;
+    size_t _mappedSize = 0;
+    bool _spilled = false;
+
+    inline int spill() {
+      std::string path = _directory;
+      if (path.empty()) {
+        const char* tmp = std::getenv("TMPDIR");
+        path = (tmp != nullptr && *tmp != '\0') ? tmp : "/tmp";
+      }
+      path += "/rtelnet-spill-XXXXXX";
+
+      _fd = mkstemp(path.data());
+      if (_fd < 0) return errno;
+
+      // Unlinked right away, nothing is left behind if the process dies.
+      unlink(path.c_str());
+      _spilled = true;
+
+      int status = flush();
+      if (status != 0) return status;
+
+      _memory.shrink_to_fit();
+      _memory.reserve(RTELNET_SPILL_CHUNK);
+      return 0;
+    }
+
+    inline int flush() {
+      const char* data = _memory.data();
+      size_t left = _memory.size();
+
+      while (left > 0) {
+        ssize_t wrote = write(_fd, data, left);
+        if (wrote < 0) {
+          if (errno == EINTR) continue;
+          return errno;
+        }
+        data += wrote;
+        left -= static_cast<size_t>(wrote);
+        _written += static_cast<size_t>(wrote);
+      }
+
+      _memory.clear();
+      return 0;
+    }
+
+    inline void release() {
+      if (_mapped != nullptr) munmap(const_cast<char*>(_mapped), _mappedSize);
+      if (_fd >= 0) close(_fd);
+      _mapped = nullptr;
+      _mappedSize = 0;
+      _fd = -1;
+      _written = 0;
+      _spilled = false;
+    }
+  };
+
+}
+#endif // RTELNET_SPILL_H
@@ -0,0 +1,1326 @@
+/*
+* TextFSM style templates for parsing show command output into rows.
+*
+* A template declares values and states of rules, in the TextFSM syntax:
+*
+*   Value Required Interface (\S+)
+*   Value Integer Mtu (\d+)
+*
+*   Start
+*     ^interface ${Interface}
+*     ^ mtu ${Mtu}
+*     ^! -> Record
+*
+* Value options: Filldown, Fillup, Required, List, Key, and the types Integer and
+* Float (an extension, values are strings otherwise). Rule actions:
+* Next|Continue|Error, .Record|.NoRecord|.Clear|.Clearall, then a state; an
+* implicit Record runs at EOF unless the template defines an EOF state.
+*
+* Rule patterns are compiled once, by our own regex compiler, into an NFA program.
+* The rules of each state are then combined into one DFA that tells, in a single
+* pass over a line, which rules match. Only a matching rule is run again on the
+* line, by a bit-state backtracker (a Pike VM for very long lines), to extract
+* its values. Supported syntax: literals, ., classes
+* ([a-z], [^ ], \d \w \s and negations), groups ((...), (?:...)), alternation,
+* * + ? {n,m} (greedy and lazy), ^, $ and (?i). Back references and lookaround are
+* rejected at compile time.
+*
+* textTemplate is immutable once compiled and can be shared between threads, each
+* parse runs in its own templateParser which also accepts the output in chunks.
+*/
+#ifndef RTELNET_TEMPLATE_H
+#define RTELNET_TEMPLATE_H
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+inline constexpr size_t RTELNET_TEMPLATE_DFA_STATES = 4096;   // Per template state, past it the rules run as an NFA
+inline constexpr int    RTELNET_TEMPLATE_MAX_REPEAT = 1000;   // Largest {n,m} bound
+inline constexpr size_t RTELNET_TEMPLATE_MAX_PROGRAM = 1 << 20; // Instructions per template
+inline constexpr size_t RTELNET_TEMPLATE_BACKTRACK_BITS = 256 * 1024; // Instructions x line length, past it captures use the Pike VM
+
+namespace rtnt {
+
+  namespace templateRegex {
+
+    enum class op : uint8_t {
+      CHAR,  // Consume one byte in sets[x]
+      SPLIT, // Fork to x (preferred) and y
+      JUMP,  // Go to x
+      SAVE,  // Record the position in capture slot x
+      BEGIN, // Only at the start of the line
+      END,   // Only at the end of the line
+      MATCH  // Rule x matched
+    };
+
+    struct inst {
+      op code;
+      int x = 0;
+      int y = 0;
+    };
+
+    struct program {
+      std::vector<inst> code;
+      std::vector<std::bitset<256>> sets;
+      std::array<uint16_t, 256> classOf{}; // Bytes no set tells apart share a class
+      int classes = 1;
+
+      // Splits the bytes into classes once every rule is compiled.
+      inline void buildClasses() {
+        std::map<std::vector<bool>, uint16_t> seen;
+        for (int byte = 0; byte < 256; ++byte) {
+          std::vector<bool> signature(sets.size());
+          for (size_t set = 0; set < sets.size(); ++set) signature[set] = sets[set].test(byte);
+          auto inserted = seen.emplace(std::move(signature), static_cast<uint16_t>(seen.size()));
+          classOf[byte] = inserted.first->second;
+        }
+        classes = static_cast<int>(seen.size());
+      }
+    };
+
+    struct node {
+      enum kind_t { EMPTY, SET, CONCAT, ALT, REPEAT, CAPTURE, BEGIN, END } kind = EMPTY;
+      int set = -1;
+      int min = 0;
+      int max = 0;       // -1 is unbounded
+      bool greedy = true;
+      int slot = -1;     // Value index of a CAPTURE
+      std::vector<node> children;
+    };
+
+    // Looks up ${name}: the value index and its regex.
+    using valueLookup = std::function<bool(const std::string& name, int& index, std::string& regex)>;
+
+    // Recursive descent over the pattern, errors carry the offset.
+    class parser {
+    public:
+      parser(std::string_view pattern, program& prog, const valueLookup* lookup, bool ignoreCase = false)
+        : _pattern(pattern), _prog(prog), _lookup(lookup), _ignoreCase(ignoreCase) {}
+
+      inline bool parse(node& out, std::string& error) {
+        if (!alternation(out) || (_pos < _pattern.size() && fail("unbalanced )"))) {
+          error = _error + " at offset " + std::to_string(_pos);
+          return false;
+        }
+        return true;
+      }
+
+    private:
+      std::string_view _pattern;
+      program& _prog;
+      const valueLookup* _lookup;
+      bool _ignoreCase;
+      size_t _pos = 0;
+      std::string _error;
+
+      inline bool fail(const std::string& message) {
+        if (_error.empty()) _error = message;
+        return false;
+      }
+
+      inline bool more() const { return _pos < _pattern.size(); }
+      inline char peek() const { return _pattern[_pos]; }
+
+      inline node setNode(std::bitset<256> set) {
+        if (_ignoreCase) {
+          for (int c = 'a'; c <= 'z'; ++c) {
+            if (set.test(c) || set.test(c - 'a' + 'A')) { set.set(c); set.set(c - 'a' + 'A'); }
+          }
+        }
+        node n;
+        n.kind = node::SET;
+        n.set = static_cast<int>(_prog.sets.size());
+        _prog.sets.push_back(set);
+        return n;
+      }
+
+      inline bool alternation(node& out) {
+        node first;
+        if (!concatenation(first)) return false;
+        if (!more() || peek() != '|') { out = std::move(first); return true; }
+
+        out = node();
+        out.kind = node::ALT;
+        out.children.push_back(std::move(first));
+        while (more() && peek() == '|') {
+          ++_pos;
+          node next;
+          if (!concatenation(next)) return false;
+          out.children.push_back(std::move(next));
+        }
+        return true;
+      }
+
+      inline bool concatenation(node& out) {
+        out = node();
+        out.kind = node::CONCAT;
+        while (more() && peek() != '|' && peek() != ')') {
+          node item;
+          if (!repetition(item)) return false;
+          if (item.kind != node::EMPTY) out.children.push_back(std::move(item));
+        }
+        return true;
+      }
+
+      inline bool repetition(node& out) {
+        node atomNode;
+        if (!atom(atomNode)) return false;
+
+        while (more()) {
+          int min = 0, max = 0;
+          size_t start = _pos;
+          char c = peek();
+          if (c == '*')      { min = 0; max = -1; ++_pos; }
+          else if (c == '+') { min = 1; max = -1; ++_pos; }
+          else if (c == '?') { min = 0; max = 1; ++_pos; }
+          else if (c == '{') {
+            if (!bounds(min, max)) { _pos = start; break; } // Not a quantifier, a literal '{'
+          } else break;
+
+          if (atomNode.kind == node::BEGIN || atomNode.kind == node::END) return fail("quantified anchor");
+          if (max != -1 && (max < min || max > RTELNET_TEMPLATE_MAX_REPEAT)) return fail("bad repeat bounds");
+
+          node repeat;
+          repeat.kind = node::REPEAT;
+          repeat.min = min;
+          repeat.max = max;
+          if (more() && peek() == '?') { repeat.greedy = false; ++_pos; }
+          repeat.children.push_back(std::move(atomNode));
+          atomNode = std::move(repeat);
+        }
+
+        out = std::move(atomNode);
+        return true;
+      }
+
+      // {n}, {n,} or {n,m}, leaves _pos after the '}'.
+      inline bool bounds(int& min, int& max) {
+        ++_pos;
+        auto number = [this](int& value) {
+          size_t start = _pos;
+          value = 0;
+          while (more() && std::isdigit(static_cast<unsigned char>(peek())) && value <= RTELNET_TEMPLATE_MAX_REPEAT) {
+            value = value * 10 + (peek() - '0');
+            ++_pos;
+          }
+          return _pos != start;
+        };
+
+        if (!number(min)) return false;
+        max = min;
+        if (more() && peek() == ',') {
+          ++_pos;
+          if (!number(max)) max = -1;
+        }
+        if (!more() || peek() != '}') return false;
+        ++_pos;
+        return true;
+      }
+
+      inline bool atom(node& out) {
+        char c = peek();
+
+        switch (c) {
+          case '(': return group(out);
+          case '.': {
+            ++_pos;
+            std::bitset<256> any;
+            any.set();
+            any.reset('\n');
+            out = setNode(any);
+            return true;
+          }
+          case '[': return charClass(out);
+          case '^': ++_pos; out.kind = node::BEGIN; return true;
+          case '$': return dollar(out);
+          case '\\': {
+            std::bitset<256> set;
+            if (!escape(set)) return false;
+            out = setNode(set);
+            return true;
+          }
+          case '*': case '+': case '?': return fail("nothing to repeat");
+          default: {
+            ++_pos;
+            std::bitset<256> set;
+            set.set(static_cast<unsigned char>(c));
+            out = setNode(set);
+            return true;
+          }
+        }
+      }
+
+      inline bool group(node& out) {
+        ++_pos;
+        if (more() && peek() == '?') {
+          ++_pos;
+          if (!more()) return fail("truncated group");
+          char kind = peek();
+          if (kind == ':') {
+            ++_pos;
+          } else if (kind == 'i' && _pos + 1 < _pattern.size() && _pattern[_pos + 1] == ')') {
+            _pos += 2;
+            _ignoreCase = true; // Applies to the rest of the pattern
+            out.kind = node::EMPTY;
+            return true;
+          } else if (kind == 'P' && _pos + 1 < _pattern.size() && _pattern[_pos + 1] == '<') {
+            size_t close = _pattern.find('>', _pos);
+            if (close == std::string_view::npos) return fail("truncated group name");
+            _pos = close + 1; // Named groups are plain groups, values are the captures
+          } else {
+            return fail("unsupported group (lookaround, flags or back reference)");
+          }
+        }
+
+        if (!alternation(out)) return false;
+        if (!more() || peek() != ')') return fail("missing )");
+        ++_pos;
+        return true;
+      }
+
+      // ${name} or $name is a value. $$ is the end anchor, as TextFSM substitutes it
+      // to a single $ before compiling; a lone $ is the anchor too. \$ is a dollar.
+      inline bool dollar(node& out) {
+        ++_pos;
+        if (more() && peek() == '$') {
+          ++_pos;
+          out.kind = node::END;
+          return true;
+        }
+
+        if (_lookup != nullptr && more() && (peek() == '{' || std::isalpha(static_cast<unsigned char>(peek())) || peek() == '_')) {
+          bool braced = peek() == '{';
+          size_t start = braced ? _pos + 1 : _pos;
+          size_t end = start;
+          while (end < _pattern.size() && (std::isalnum(static_cast<unsigned char>(_pattern[end])) || _pattern[end] == '_')) ++end;
+          if (braced && (end >= _pattern.size() || _pattern[end] != '}')) return fail("bad ${name}");
+
+          std::string name(_pattern.substr(start, end - start));
+          int index = 0;
+          std::string regex;
+          if (!(*_lookup)(name, index, regex)) {
+            if (braced) return fail("unknown value " + name);
+            out.kind = node::END; // $ followed by text that is not a value
+            return true;
+          }
+
+          _pos = braced ? end + 1 : end;
+
+          node inner;
+          parser valueParser(regex, _prog, nullptr, _ignoreCase);
+          std::string error;
+          if (!valueParser.parse(inner, error)) return fail("value " + name + ": " + error);
+
+          out = node();
+          out.kind = node::CAPTURE;
+          out.slot = index;
+          out.children.push_back(std::move(inner));
+          return true;
+        }
+
+        out.kind = node::END;
+        return true;
+      }
+
+      inline bool charClass(node& out) {
+        ++_pos;
+        bool negate = more() && peek() == '^';
+        if (negate) ++_pos;
+
+        std::bitset<256> set;
+        bool first = true;
+        while (more() && (peek() != ']' || first)) {
+          first = false;
+
+          std::bitset<256> item;
+          int low = -1;
+          if (peek() == '\\') {
+            if (!escape(item, true)) return false;
+            if (item.count() == 1) for (int c = 0; c < 256; ++c) if (item.test(c)) low = c;
+          } else {
+            low = static_cast<unsigned char>(peek());
+            item.set(low);
+            ++_pos;
+          }
+
+          // a-z, a '-' at either end is literal
+          if (low >= 0 && _pos + 1 < _pattern.size() && peek() == '-' && _pattern[_pos + 1] != ']') {
+            ++_pos;
+            int high = static_cast<unsigned char>(peek());
+            if (peek() == '\\') {
+              std::bitset<256> upper;
+              if (!escape(upper, true) || upper.count() != 1) return fail("bad class range");
+              for (int c = 0; c < 256; ++c) if (upper.test(c)) high = c;
+            } else {
+              ++_pos;
+            }
+            if (high < low) return fail("bad class range");
+            for (int c = low; c <= high; ++c) item.set(c);
+          }
+
+          set |= item;
+        }
+        if (!more()) return fail("missing ]");
+        ++_pos;
+
+        if (negate) set.flip();
+        out = setNode(set);
+        return true;
+      }
+
+      inline bool escape(std::bitset<256>& set, bool inClass = false) {
+        ++_pos;
+        if (!more()) return fail("trailing \\");
+        char c = peek();
+        ++_pos;
+
+        auto range = [&set](int low, int high) { for (int b = low; b <= high; ++b) set.set(b); };
+        auto digits = [&]() { range('0', '9'); };
+        auto word = [&]() { range('a', 'z'); range('A', 'Z'); range('0', '9'); set.set('_'); };
+        auto space = [&]() { for (char s : {' ', '\t', '\n', '\r', '\f', '\v'}) set.set(static_cast<unsigned char>(s)); };
+
+        switch (c) {
+          case 'd': digits(); return true;
+          case 'w': word(); return true;
+          case 's': space(); return true;
+          case 'D': digits(); set.flip(); return true;
+          case 'W': word(); set.flip(); return true;
+          case 'S': space(); set.flip(); return true;
+          case 't': set.set('\t'); return true;
+          case 'n': set.set('\n'); return true;
+          case 'r': set.set('\r'); return true;
+          case 'f': set.set('\f'); return true;
+          case 'v': set.set('\v'); return true;
+          case 'x': {
+            if (_pos + 2 > _pattern.size() || !std::isxdigit(static_cast<unsigned char>(_pattern[_pos])) ||
+                !std::isxdigit(static_cast<unsigned char>(_pattern[_pos + 1]))) return fail("bad \\x escape");
+            set.set(std::stoi(std::string(_pattern.substr(_pos, 2)), nullptr, 16));
+            _pos += 2;
+            return true;
+          }
+          default:
+            if (std::isalnum(static_cast<unsigned char>(c)) && !(inClass && c == 'b')) {
+              return fail(std::string("unsupported escape \\") + c);
+            }
+            set.set(static_cast<unsigned char>(inClass && c == 'b' ? '\b' : c));
+            return true;
+        }
+      }
+    };
+
+    // Thompson construction of one node into prog.code.
+    inline void emit(const node& n, program& prog) {
+      std::vector<inst>& code = prog.code;
+
+      switch (n.kind) {
+        case node::EMPTY: break;
+        case node::SET:   code.push_back({op::CHAR, n.set}); break;
+        case node::BEGIN: code.push_back({op::BEGIN}); break;
+        case node::END:   code.push_back({op::END}); break;
+
+        case node::CONCAT:
+          for (const node& child : n.children) emit(child, prog);
+          break;
+
+        case node::ALT: {
+          std::vector<size_t> exits;
+          for (size_t i = 0; i + 1 < n.children.size(); ++i) {
+            size_t split = code.size();
+            code.push_back({op::SPLIT, static_cast<int>(split + 1)});
+            emit(n.children[i], prog);
+            exits.push_back(code.size());
+            code.push_back({op::JUMP});
+            code[split].y = static_cast<int>(code.size());
+          }
+          emit(n.children.back(), prog);
+          for (size_t exit : exits) code[exit].x = static_cast<int>(code.size());
+          break;
+        }
+
+        case node::CAPTURE:
+          code.push_back({op::SAVE, 2 * n.slot});
+          emit(n.children[0], prog);
+          code.push_back({op::SAVE, 2 * n.slot + 1});
+          break;
+
+        case node::REPEAT: {
+          const node& child = n.children[0];
+          for (int i = 0; i < n.min; ++i) emit(child, prog);
+
+          auto fork = [&](size_t split, int body, int exit) {
+            code[split].x = n.greedy ? body : exit;
+            code[split].y = n.greedy ? exit : body;
+          };
+
+          if (n.max == -1) {
+            size_t split = code.size();
+            code.push_back({op::SPLIT});
+            emit(child, prog);
+            code.push_back({op::JUMP, static_cast<int>(split)});
+            fork(split, static_cast<int>(split + 1), static_cast<int>(code.size()));
+            break;
+          }
+
+          std::vector<size_t> splits;
+          for (int i = n.min; i < n.max; ++i) {
+            splits.push_back(code.size());
+            code.push_back({op::SPLIT});
+            emit(child, prog);
+          }
+          for (size_t split : splits) fork(split, static_cast<int>(split + 1), static_cast<int>(code.size()));
+          break;
+        }
+      }
+    }
+
+    // Epsilon closure: follows forks, saves and passing anchors, keeps the pcs that
+    // consume, match or wait for the end of the line.
+    class closure {
+    public:
+      explicit closure(const program& prog) : _prog(prog), _mark(prog.code.size(), 0) {}
+
+      inline void run(const std::vector<int>& seeds, bool atBegin, bool atEnd, std::vector<int>& out) {
+        ++_generation;
+        out.clear();
+        _stack.assign(seeds.rbegin(), seeds.rend());
+
+        while (!_stack.empty()) {
+          int pc = _stack.back();
+          _stack.pop_back();
+          if (_mark[pc] == _generation) continue;
+          _mark[pc] = _generation;
+
+          const inst& i = _prog.code[pc];
+          switch (i.code) {
+            case op::SPLIT: _stack.push_back(i.y); _stack.push_back(i.x); break;
+            case op::JUMP:  _stack.push_back(i.x); break;
+            case op::SAVE:  _stack.push_back(pc + 1); break;
+            case op::BEGIN: if (atBegin) _stack.push_back(pc + 1); break;
+            case op::END:
+              if (atEnd) _stack.push_back(pc + 1);
+              else out.push_back(pc);
+              break;
+            case op::CHAR:
+            case op::MATCH: out.push_back(pc); break;
+          }
+        }
+
+        std::sort(out.begin(), out.end());
+      }
+
+    private:
+      const program& _prog;
+      std::vector<uint32_t> _mark;
+      uint32_t _generation = 0;
+      std::vector<int> _stack;
+    };
+
+    // The rules of one state as a DFA over byte classes: which of them match a line.
+    // A DFA state is the NFA set plus the rules matched so far, so the scan itself is
+    // nothing but table lookups and the state it ends in holds the answer.
+    class ruleMatcher {
+    public:
+      inline void build(const program& prog, const std::vector<int>& starts, size_t limit) {
+        _starts = starts;
+        _states.clear();
+        _table.clear();
+        _classes = prog.classes;
+        _complete = true;
+
+        closure close(prog);
+        std::map<std::pair<std::vector<int>, std::vector<int>>, int> index;
+        std::vector<std::pair<std::vector<int>, std::vector<int>>> keys;
+
+        // Live states are table offsets, states no rule can still reach are ~state.
+        auto intern = [&](const std::vector<int>& set, std::vector<int> matched) {
+          for (int pc : set) if (prog.code[pc].code == op::MATCH) matched.push_back(prog.code[pc].x);
+          std::sort(matched.begin(), matched.end());
+          matched.erase(std::unique(matched.begin(), matched.end()), matched.end());
+
+          auto key = std::make_pair(set, matched);
+          auto found = index.find(key);
+          if (found != index.end()) return found->second;
+
+          int state = static_cast<int>(keys.size());
+          int entry = set.empty() ? ~state : state * _classes;
+          index.emplace(key, entry);
+          keys.push_back(std::move(key));
+          _states.push_back(accepting(prog, close, keys.back().first, keys.back().second));
+          _table.resize(_table.size() + _classes, 0);
+          return entry;
+        };
+
+        std::vector<int> set;
+        close.run(starts, true, false, set);
+        _start = intern(set, {});
+
+        std::vector<int> representative(_classes, -1);
+        for (int byte = 255; byte >= 0; --byte) representative[prog.classOf[byte]] = byte;
+
+        std::vector<int> seeds;
+        for (size_t state = 0; state < keys.size(); ++state) {
+          if (keys.size() > limit) { _complete = false; break; }
+          if (keys[state].first.empty()) continue;
+
+          for (int cls = 0; cls < _classes; ++cls) {
+            seeds.clear();
+            for (int pc : keys[state].first) {
+              const inst& i = prog.code[pc];
+              if (i.code == op::CHAR && prog.sets[i.x].test(representative[cls])) seeds.push_back(pc + 1);
+            }
+            close.run(seeds, false, false, set);
+            _table[state * _classes + cls] = intern(set, keys[state].second);
+          }
+        }
+
+        if (!_complete) {
+          _states.clear();
+          _table.clear();
+        }
+      }
+
+      // Sets matched[rule] for every rule of the state that matches `line`.
+      inline void match(const program& prog, std::string_view line, std::vector<char>& matched) const {
+        std::fill(matched.begin(), matched.end(), 0);
+        if (!_complete) return simulate(prog, line, matched);
+
+        int entry = _start;
+        const unsigned char* c = reinterpret_cast<const unsigned char*>(line.data());
+        const unsigned char* end = c + line.size();
+        while (entry >= 0 && c != end) entry = _table[entry + prog.classOf[*c++]];
+
+        // Ran out of line in a live state: the rules ending in $ get their chance.
+        const dstate& last = (entry < 0) ? _states[~entry] : _states[entry / _classes];
+        for (int rule : (entry < 0 || c != end) ? last.matched : last.matchedAtEnd) matched[rule] = 1;
+      }
+
+      inline size_t states() const { return _states.size(); }
+      inline bool complete() const { return _complete; }
+
+    private:
+      struct dstate {
+        std::vector<int> matched;      // Rules matched on the way to this state
+        std::vector<int> matchedAtEnd; // The same, plus the ones ending with $, when the line ends here
+      };
+
+      std::vector<int> _starts;
+      int _start = 0;
+      int _classes = 1;
+      std::vector<dstate> _states;
+      std::vector<int> _table; // offset + class -> next entry
+      bool _complete = false;
+
+      static inline dstate accepting(const program& prog, closure& close, const std::vector<int>& set, const std::vector<int>& matched) {
+        dstate state;
+        state.matched = matched;
+        state.matchedAtEnd = matched;
+
+        std::vector<int> ends;
+        for (int pc : set) if (prog.code[pc].code == op::END) ends.push_back(pc);
+        if (!ends.empty()) {
+          std::vector<int> reached;
+          close.run(ends, false, true, reached);
+          for (int pc : reached) {
+            if (prog.code[pc].code == op::MATCH) state.matchedAtEnd.push_back(prog.code[pc].x);
+          }
+        }
+        return state;
+      }
+
+      // Same answer without the table, for states whose DFA got too large.
+      inline void simulate(const program& prog, std::string_view line, std::vector<char>& matched) const {
+        closure close(prog);
+        std::vector<int> set, seeds;
+        close.run(_starts, true, false, set);
+
+        auto collect = [&](bool atEnd) {
+          for (int pc : set) if (prog.code[pc].code == op::MATCH) matched[prog.code[pc].x] = 1;
+          if (!atEnd) return;
+          seeds.clear();
+          for (int pc : set) if (prog.code[pc].code == op::END) seeds.push_back(pc);
+          std::vector<int> reached;
+          close.run(seeds, false, true, reached);
+          for (int pc : reached) if (prog.code[pc].code == op::MATCH) matched[prog.code[pc].x] = 1;
+        };
+
+        for (unsigned char c : line) {
+          collect(false);
+          seeds.clear();
+          for (int pc : set) {
+            const inst& i = prog.code[pc];
+            if (i.code == op::CHAR && prog.sets[i.x].test(c)) seeds.push_back(pc + 1);
+          }
+          if (seeds.empty()) return;
+          close.run(seeds, false, false, set);
+        }
+        collect(true);
+      }
+    };
+
+    // Backtracking over one rule with a visited bit per (instruction, position), as in
+    // RE2's BitState: linear like the Pike VM but without copying captures around,
+    // so much faster on the short lines of command output. Long lines are refused
+    // and left to the Pike VM.
+    class backtracker {
+    public:
+      inline bool run(const program& prog, int start, int end, std::string_view line, std::vector<int>& captures) {
+        size_t width = static_cast<size_t>(end - start), positions = line.size() + 1;
+        if (width * positions > RTELNET_TEMPLATE_BACKTRACK_BITS) return false;
+
+        _visited.assign((width * positions + 63) / 64, 0);
+        _jobs.clear();
+        _jobs.push_back({start, 0, -1});
+
+        while (!_jobs.empty()) {
+          job current = _jobs.back();
+          _jobs.pop_back();
+          if (current.slot >= 0) { captures[current.slot] = current.pos; continue; }
+
+          int pc = current.pc;
+          size_t pos = static_cast<size_t>(current.pos);
+          while (true) {
+            size_t bit = static_cast<size_t>(pc - start) * positions + pos;
+            if (_visited[bit / 64] & (uint64_t(1) << (bit % 64))) break;
+            _visited[bit / 64] |= uint64_t(1) << (bit % 64);
+
+            const inst& i = prog.code[pc];
+            if (i.code == op::CHAR) {
+              if (pos == line.size() || !prog.sets[i.x].test(static_cast<unsigned char>(line[pos]))) break;
+              ++pc;
+              ++pos;
+            } else if (i.code == op::SPLIT) {
+              _jobs.push_back({i.y, static_cast<int>(pos), -1}); // Lower priority, tried later
+              pc = i.x;
+            } else if (i.code == op::JUMP) {
+              pc = i.x;
+            } else if (i.code == op::SAVE) {
+              _jobs.push_back({0, captures[i.x], i.x}); // Undone when backtracking past it
+              captures[i.x] = static_cast<int>(pos);
+              ++pc;
+            } else if (i.code == op::BEGIN) {
+              if (pos != 0) break;
+              ++pc;
+            } else if (i.code == op::END) {
+              if (pos != line.size()) break;
+              ++pc;
+            } else {
+              return true; // MATCH
+            }
+          }
+        }
+        return false;
+      }
+
+    private:
+      struct job {
+        int pc;
+        int pos;  // Or the value to restore
+        int slot; // >= 0: restore captures[slot]
+      };
+
+      std::vector<uint64_t> _visited;
+      std::vector<job> _jobs;
+    };
+
+    // Pike VM for one rule: the captures of its leftmost, highest priority match,
+    // the same ones a backtracking matcher would report.
+    class pikeVM {
+    public:
+      pikeVM(const program& prog, size_t slots)
+        : _prog(prog), _slots(slots), _scratch(slots, -1), _current(prog.code.size()), _next(prog.code.size()) {}
+
+      inline bool run(int start, std::string_view line, std::vector<int>& captures) {
+        std::fill(_scratch.begin(), _scratch.end(), -1);
+        _current.clear();
+        add(_current, start, 0, line.size());
+
+        bool matched = false;
+        for (size_t pos = 0; pos <= line.size() && !_current.empty(); ++pos) {
+          _next.clear();
+          for (size_t t = 0; t < _current.size(); ++t) {
+            const inst& i = _prog.code[_current.pcs[t]];
+            const int* threadCaptures = _current.captures.data() + t * _slots;
+            if (i.code == op::MATCH) {
+              captures.assign(threadCaptures, threadCaptures + _slots);
+              matched = true;
+              break; // Lower priority threads lose
+            }
+            if (i.code == op::CHAR && pos < line.size() && _prog.sets[i.x].test(static_cast<unsigned char>(line[pos]))) {
+              std::copy(threadCaptures, threadCaptures + _slots, _scratch.begin());
+              add(_next, _current.pcs[t] + 1, pos + 1, line.size());
+            }
+          }
+          std::swap(_current, _next);
+        }
+        return matched;
+      }
+
+    private:
+      // Threads in priority order, their captures side by side in one array.
+      struct threadList {
+        explicit threadList(size_t size) : seen(size, 0) {}
+        std::vector<int> pcs;
+        std::vector<int> captures;
+        std::vector<uint32_t> seen;
+        uint32_t generation = 1;
+
+        inline void clear() { pcs.clear(); captures.clear(); ++generation; }
+        inline bool empty() const { return pcs.empty(); }
+        inline size_t size() const { return pcs.size(); }
+      };
+
+      const program& _prog;
+      size_t _slots;
+      std::vector<int> _scratch; // Captures of the thread being added
+      threadList _current;
+      threadList _next;
+
+      inline void add(threadList& list, int pc, size_t pos, size_t length) {
+        if (list.seen[pc] == list.generation) return;
+        list.seen[pc] = list.generation;
+
+        const inst& i = _prog.code[pc];
+        switch (i.code) {
+          case op::SPLIT: add(list, i.x, pos, length); add(list, i.y, pos, length); break;
+          case op::JUMP:  add(list, i.x, pos, length); break;
+          case op::SAVE: {
+            int saved = _scratch[i.x];
+            _scratch[i.x] = static_cast<int>(pos);
+            add(list, pc + 1, pos, length);
+            _scratch[i.x] = saved;
+            break;
+          }
+          case op::BEGIN: if (pos == 0) add(list, pc + 1, pos, length); break;
+          case op::END:   if (pos == length) add(list, pc + 1, pos, length); break;
+          case op::CHAR:
+          case op::MATCH:
+            list.pcs.push_back(pc);
+            list.captures.insert(list.captures.end(), _scratch.begin(), _scratch.end());
+            break;
+        }
+      }
+    };
+
+  }
+
+  enum class templateValueType { STRING, INTEGER, FLOAT };
+
+  struct templateValue {
+    std::string name;
+    std::string regex;
+    templateValueType type = templateValueType::STRING;
+    bool filldown = false; // Kept across records
+    bool fillup = false;   // Copied up into earlier records that lack it
+    bool required = false; // Records without it are dropped
+    bool list = false;     // Every match is appended
+    bool key = false;      // Informational, as in TextFSM
+  };
+
+  // Empty, text, Integer, Float or List. Integer and Float values that do not parse stay text.
+  using templateField = std::variant<std::monostate, std::string, int64_t, double, std::vector<std::string>>;
+
+  struct templateResult {
+    std::vector<std::string> header; // Value names, in declaration order
+    std::vector<std::vector<templateField>> rows;
+    std::string error;               // Message of the Error rule that stopped the parse
+  };
+
+  class textTemplate {
+  public:
+    enum class recordOp { NONE, RECORD, CLEAR, CLEARALL };
+
+    struct rule {
+      std::string pattern;
+      int line = 0;             // In the template text
+      int start = 0;            // First instruction
+      int end = 0;              // One past its MATCH
+      bool captures = false;    // Sets at least one value
+      bool continues = false;   // Continue: the next rules see the same line
+      recordOp record = recordOp::NONE;
+      int nextState = -1;       // -1 stays in the state
+      bool error = false;
+      std::string message;      // Error text
+    };
+
+    struct state {
+      std::string name;
+      std::vector<rule> rules;
+      templateRegex::ruleMatcher matcher;
+    };
+
+    static constexpr int END_STATE = -2;
+
+    // Replaces whatever was compiled before. `error` names the template line.
+    inline bool compile(std::string_view text, std::string& error) {
+      *this = textTemplate();
+
+      std::vector<std::pair<int, std::string>> lines;
+      {
+        std::istringstream input{std::string(text)};
+        std::string line;
+        int number = 0;
+        while (std::getline(input, line)) {
+          ++number;
+          if (!line.empty() && line.back() == '\r') line.pop_back();
+          lines.emplace_back(number, line);
+        }
+      }
+
+      size_t at = 0;
+      auto blank = [](const std::string& line) { return line.find_first_not_of(" \t") == std::string::npos; };
+      auto comment = [](const std::string& line) {
+        size_t first = line.find_first_not_of(" \t");
+        return first != std::string::npos && line[first] == '#';
+      };
+      auto failAt = [&error](int line, const std::string& message) {
+        error = "line " + std::to_string(line) + ": " + message;
+        return false;
+      };
+
+      // Values, up to the first blank line.
+      for (; at < lines.size(); ++at) {
+        const auto& [number, line] = lines[at];
+        if (comment(line)) continue;
+        if (blank(line)) { if (!_values.empty()) break; continue; }
+        if (line.rfind("Value ", 0) != 0) break;
+        if (!parseValue(line, number, error)) return false;
+      }
+      if (_values.empty()) return failAt(at < lines.size() ? lines[at].first : 0, "no Value declared");
+
+      // States: a name on its own line, rules indented below it.
+      std::vector<std::vector<std::pair<int, std::string>>> pendingActions;
+      for (; at < lines.size(); ++at) {
+        const auto& [number, line] = lines[at];
+        if (comment(line) || blank(line)) continue;
+
+        if (line[0] != ' ' && line[0] != '\t') {
+          for (char c : line) if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') return failAt(number, "bad state name '" + line + "'");
+          if (line == "End") return failAt(number, "End is a reserved state");
+          if (stateIndex(line) >= 0) return failAt(number, "duplicate state " + line);
+          _states.push_back(state{line, {}, {}});
+          pendingActions.emplace_back();
+          continue;
+        }
+
+        if (_states.empty()) return failAt(number, "rule outside of a state");
+        std::string trimmed = line.substr(line.find_first_not_of(" \t"));
+        if (trimmed[0] != '^') return failAt(number, "rules start with ^");
+
+        // As in TextFSM the action follows the last whitespace + "->".
+        rule parsed;
+        parsed.line = number;
+        std::string action;
+        size_t arrow = std::string::npos;
+        for (size_t p = trimmed.size(); p-- > 1;) {
+          if (trimmed.compare(p, 2, "->") == 0 && (trimmed[p - 1] == ' ' || trimmed[p - 1] == '\t')) { arrow = p; break; }
+        }
+        if (arrow != std::string::npos) {
+          parsed.pattern = trimmed.substr(0, arrow - 1);
+          action = trimmed.substr(arrow + 2);
+        } else {
+          parsed.pattern = trimmed;
+        }
+
+        _states.back().rules.push_back(parsed);
+        pendingActions.back().emplace_back(number, action);
+      }
+
+      _start = stateIndex("Start");
+      if (_start < 0) return failAt(0, "no Start state");
+
+      // Actions once every state name is known.
+      for (size_t s = 0; s < _states.size(); ++s) {
+        for (size_t r = 0; r < _states[s].rules.size(); ++r) {
+          const auto& [number, action] = pendingActions[s][r];
+          if (!parseAction(action, _states[s].rules[r], number, error)) return false;
+        }
+      }
+      _hasEOF = stateIndex("EOF") >= 0;
+
+      // Rule patterns into one program.
+      templateRegex::valueLookup lookup = [this](const std::string& name, int& index, std::string& regex) {
+        for (size_t v = 0; v < _values.size(); ++v) {
+          if (_values[v].name == name) { index = static_cast<int>(v); regex = _values[v].regex; return true; }
+        }
+        return false;
+      };
+
+      for (state& current : _states) {
+        for (size_t r = 0; r < current.rules.size(); ++r) {
+          rule& compiled = current.rules[r];
+          templateRegex::node root;
+          templateRegex::parser parser(compiled.pattern, _program, &lookup);
+          std::string regexError;
+          if (!parser.parse(root, regexError)) return failAt(compiled.line, regexError);
+
+          compiled.start = static_cast<int>(_program.code.size());
+          templateRegex::emit(root, _program);
+          _program.code.push_back({templateRegex::op::MATCH, static_cast<int>(r)});
+          compiled.end = static_cast<int>(_program.code.size());
+          for (int pc = compiled.start; pc < compiled.end; ++pc) {
+            compiled.captures = compiled.captures || _program.code[pc].code == templateRegex::op::SAVE;
+          }
+          if (_program.code.size() > RTELNET_TEMPLATE_MAX_PROGRAM) return failAt(compiled.line, "template too large");
+        }
+      }
+
+      _program.buildClasses();
+      for (state& current : _states) {
+        std::vector<int> starts;
+        for (const rule& compiled : current.rules) starts.push_back(compiled.start);
+        current.matcher.build(_program, starts, RTELNET_TEMPLATE_DFA_STATES);
+      }
+
+      _compiled = true;
+      return true;
+    }
+
+    inline bool load(const std::string& path, std::string& error) {
+      std::ifstream file(path);
+      if (!file) {
+        error = path + ": cannot open";
+        return false;
+      }
+      std::stringstream text;
+      text << file.rdbuf();
+      return compile(text.str(), error);
+    }
+
+    inline bool compiled() const { return _compiled; }
+    inline const std::vector<templateValue>& values() const { return _values; }
+    inline const std::vector<state>& states() const { return _states; }
+    inline const templateRegex::program& program() const { return _program; }
+    inline bool hasEOF() const { return _hasEOF; }
+    inline int startState() const { return _start; }
+
+    inline int stateIndex(const std::string& name) const {
+      for (size_t s = 0; s < _states.size(); ++s) if (_states[s].name == name) return static_cast<int>(s);
+      return -1;
+    }
+
+    // Whole output at once, false when an Error rule fired (see result.error).
+    inline bool parse(std::string_view text, templateResult& result) const;
+
+  private:
+    std::vector<templateValue> _values;
+    std::vector<state> _states;
+    templateRegex::program _program;
+    int _start = 0;
+    bool _hasEOF = false;
+    bool _compiled = false;
+
+    inline bool parseValue(const std::string& line, int number, std::string& error) {
+      std::vector<std::string> tokens;
+      std::istringstream words(line);
+      for (std::string word; words >> word;) tokens.push_back(word);
+      if (tokens.size() < 3) {
+        error = "line " + std::to_string(number) + ": Value needs a name and a regex";
+        return false;
+      }
+
+      // Value [options] name (regex), the regex runs to the end of the line.
+      templateValue value;
+      bool hasOptions = tokens[2][0] != '(';
+      if (hasOptions) {
+        std::stringstream options(tokens[1]);
+        for (std::string option; std::getline(options, option, ',');) {
+          if (option == "Filldown")      value.filldown = true;
+          else if (option == "Fillup")   value.fillup = true;
+          else if (option == "Required") value.required = true;
+          else if (option == "List")     value.list = true;
+          else if (option == "Key")      value.key = true;
+          else if (option == "Integer")  value.type = templateValueType::INTEGER;
+          else if (option == "Float")    value.type = templateValueType::FLOAT;
+          else {
+            error = "line " + std::to_string(number) + ": unknown Value option " + option;
+            return false;
+          }
+        }
+      }
+
+      size_t cursor = 0;
+      auto skipToken = [&line, &cursor]() {
+        cursor = line.find_first_not_of(" \t", cursor);
+        cursor = line.find_first_of(" \t", cursor);
+      };
+      skipToken(); // Value
+      if (hasOptions) skipToken();
+      skipToken(); // name
+
+      value.name = tokens[hasOptions ? 2 : 1];
+      size_t regexAt = (cursor == std::string::npos) ? std::string::npos : line.find_first_not_of(" \t", cursor);
+      value.regex = (regexAt != std::string::npos) ? line.substr(regexAt) : "";
+      while (!value.regex.empty() && (value.regex.back() == ' ' || value.regex.back() == '\t')) value.regex.pop_back();
+
+      if (value.regex.size() < 2 || value.regex.front() != '(' || value.regex.back() != ')') {
+        error = "line " + std::to_string(number) + ": Value regex must be in ( )";
+        return false;
+      }
+      for (const templateValue& existing : _values) {
+        if (existing.name == value.name) {
+          error = "line " + std::to_string(number) + ": duplicate Value " + value.name;
+          return false;
+        }
+      }
+
+      _values.push_back(std::move(value));
+      return true;
+    }
+
+    // [Next|Continue|Error][.Record|.NoRecord|.Clear|.Clearall] [State|"message"]
+    inline bool parseAction(const std::string& action, rule& parsed, int number, std::string& error) {
+      auto failAt = [&](const std::string& message) {
+        error = "line " + std::to_string(number) + ": " + message;
+        return false;
+      };
+
+      size_t first = action.find_first_not_of(" \t");
+      if (first == std::string::npos) return true;
+      std::string text = action.substr(first);
+      while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.pop_back();
+
+      size_t space = text.find_first_of(" \t");
+      std::string head = text.substr(0, space);
+      std::string rest = (space == std::string::npos) ? "" : text.substr(text.find_first_not_of(" \t", space));
+
+      auto recordFrom = [&](const std::string& name) {
+        if (name == "Record")   { parsed.record = recordOp::RECORD; return true; }
+        if (name == "NoRecord") { parsed.record = recordOp::NONE; return true; }
+        if (name == "Clear")    { parsed.record = recordOp::CLEAR; return true; }
+        if (name == "Clearall") { parsed.record = recordOp::CLEARALL; return true; }
+        return false;
+      };
+
+      std::string lineOp = head.substr(0, head.find('.'));
+      std::string recOp = (head.find('.') == std::string::npos) ? "" : head.substr(head.find('.') + 1);
+
+      std::string target;
+      if (lineOp == "Next" || lineOp == "Continue" || lineOp == "Error") {
+        if (!recOp.empty() && !recordFrom(recOp)) return failAt("unknown record action " + recOp);
+        parsed.continues = lineOp == "Continue";
+        parsed.error = lineOp == "Error";
+        target = rest;
+      } else if (recordFrom(head)) {
+        target = rest;
+      } else {
+        if (!rest.empty()) return failAt("unknown action " + text);
+        target = head;
+      }
+
+      if (parsed.error) {
+        if (target.size() >= 2 && target.front() == '"' && target.back() == '"') target = target.substr(1, target.size() - 2);
+        parsed.message = target.empty() ? "rule at line " + std::to_string(number) : target;
+        return true;
+      }
+
+      if (target.empty()) return true;
+      if (parsed.continues) return failAt("Continue cannot change state");
+      if (target == "End") { parsed.nextState = END_STATE; return true; }
+
+      parsed.nextState = stateIndex(target);
+      if (parsed.nextState < 0) return failAt("unknown state " + target);
+      return true;
+    }
+  };
+
+  // One parse of a compiled template. Output can be fed in chunks of any size,
+  // lines are processed as soon as they are complete.
+  class templateParser {
+  public:
+    explicit templateParser(const textTemplate& compiled)
+      : _template(compiled),
+        _vm(compiled.program(), 2 * compiled.values().size()),
+        _values(compiled.values().size()),
+        _lists(compiled.values().size()),
+        _captures(2 * compiled.values().size(), -1) {
+      for (const templateValue& value : compiled.values()) _result.header.push_back(value.name);
+      size_t rules = 0;
+      for (const auto& current : compiled.states()) rules = std::max(rules, current.rules.size());
+      _matched.resize(rules);
+      if (!compiled.compiled()) stop("template is not compiled");
+    }
+
+    // False once an Error rule fired, later input is ignored.
+    inline bool feed(std::string_view chunk) {
+      while (!chunk.empty() && running()) {
+        size_t newline = chunk.find('\n');
+        if (newline == std::string_view::npos) {
+          _partial.append(chunk);
+          break;
+        }
+
+        if (_partial.empty()) {
+          line(chunk.substr(0, newline));
+        } else {
+          _partial.append(chunk.substr(0, newline));
+          line(_partial);
+          _partial.clear();
+        }
+        chunk.remove_prefix(newline + 1);
+      }
+      return _result.error.empty();
+    }
+
+    // Runs the last unterminated line and the EOF record.
+    inline bool finish() {
+      if (!_finished) {
+        _finished = true;
+        if (!_partial.empty() && running()) line(_partial);
+        _partial.clear();
+        if (running() && !_template.hasEOF()) record();
+      }
+      return _result.error.empty();
+    }
+
+    inline const templateResult& result() const { return _result; }
+    inline templateResult take() { return std::move(_result); }
+
+  private:
+    const textTemplate& _template;
+    templateRegex::backtracker _backtracker;
+    templateRegex::pikeVM _vm;
+    std::vector<std::string> _values;
+    std::vector<std::vector<std::string>> _lists;
+    std::vector<int> _captures;
+    std::vector<char> _matched;
+    std::string _partial;
+    int _state = _template.startState();
+    bool _finished = false;
+    templateResult _result;
+
+    inline bool running() const { return _state != textTemplate::END_STATE && _result.error.empty(); }
+
+    inline void stop(const std::string& message) { _result.error = message; }
+
+    inline void line(std::string_view text) {
+      if (!text.empty() && text.back() == '\r') text.remove_suffix(1);
+
+      const textTemplate::state& current = _template.states()[_state];
+      current.matcher.match(_template.program(), text, _matched);
+
+      for (size_t r = 0; r < current.rules.size(); ++r) {
+        if (!_matched[r]) continue;
+        const textTemplate::rule& matched = current.rules[r];
+
+        if (matched.captures) {
+          std::fill(_captures.begin(), _captures.end(), -1);
+          if (!_backtracker.run(_template.program(), matched.start, matched.end, text, _captures)) {
+            std::fill(_captures.begin(), _captures.end(), -1);
+            _vm.run(matched.start, text, _captures);
+          }
+          assign(text);
+        }
+
+        if (matched.error) return stop(matched.message);
+
+        switch (matched.record) {
+          case textTemplate::recordOp::RECORD:   record(); break;
+          case textTemplate::recordOp::CLEAR:    clear(false); break;
+          case textTemplate::recordOp::CLEARALL: clear(true); break;
+          case textTemplate::recordOp::NONE:     break;
+        }
+
+        if (matched.continues) continue;
+        if (matched.nextState != -1) _state = matched.nextState;
+        return;
+      }
+    }
+
+    inline void assign(std::string_view text) {
+      const std::vector<templateValue>& values = _template.values();
+      for (size_t v = 0; v < values.size(); ++v) {
+        int begin = _captures[2 * v], end = _captures[2 * v + 1];
+        if (begin < 0 || end < begin) continue;
+
+        std::string captured(text.substr(begin, end - begin));
+        if (values[v].list) {
+          _lists[v].push_back(std::move(captured));
+          continue;
+        }
+
+        if (values[v].fillup) {
+          for (auto row = _result.rows.rbegin(); row != _result.rows.rend(); ++row) {
+            if (!std::holds_alternative<std::monostate>((*row)[v])) break;
+            (*row)[v] = field(values[v], captured);
+          }
+        }
+        _values[v] = std::move(captured);
+      }
+    }
+
+    inline void record() {
+      const std::vector<templateValue>& values = _template.values();
+
+      bool any = false;
+      for (size_t v = 0; v < values.size(); ++v) {
+        bool empty = values[v].list ? _lists[v].empty() : _values[v].empty();
+        if (values[v].required && empty) return clear(false);
+        any = any || !empty;
+      }
+      if (!any) return;
+
+      std::vector<templateField> row;
+      row.reserve(values.size());
+      for (size_t v = 0; v < values.size(); ++v) {
+        if (values[v].list) row.emplace_back(_lists[v]);
+        else row.push_back(field(values[v], _values[v]));
+      }
+      _result.rows.push_back(std::move(row));
+      clear(false);
+    }
+
+    inline void clear(bool all) {
+      const std::vector<templateValue>& values = _template.values();
+      for (size_t v = 0; v < values.size(); ++v) {
+        if (values[v].filldown && !all) continue;
+        _values[v].clear();
+        _lists[v].clear();
+      }
+    }
+
+    static inline templateField field(const templateValue& value, const std::string& text) {
+      if (text.empty()) return std::monostate();
+
+      char* end = nullptr;
+      errno = 0;
+      switch (value.type) {
+        case templateValueType::INTEGER: {
+          long long number = std::strtoll(text.c_str(), &end, 10);
+          if (errno == 0 && end == text.c_str() + text.size()) return static_cast<int64_t>(number);
+          break;
+        }
+        case templateValueType::FLOAT: {
+          double number = std::strtod(text.c_str(), &end);
+          if (errno == 0 && end == text.c_str() + text.size()) return number;
+          break;
+        }
+        case templateValueType::STRING: break;
+      }
+      return text;
+    }
+  };
+
+  inline bool textTemplate::parse(std::string_view text, templateResult& result) const {
+    templateParser parser(*this);
+    parser.feed(text);
+    bool ok = parser.finish();
+    result = parser.take();
+    return ok;
+  }
+
+}
+#endif // RTELNET_TEMPLATE_H
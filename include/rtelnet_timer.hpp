@@ -0,0 +1,363 @@
+/*
+* Hierarchical timer wheel shared by every relic telnet session.
+*
+* 4 levels of 64 slots, RTELNET_TIMER_TICK ms per level 0 slot, which covers
+* 64^4 ticks (~4.6 hours at 1 ms). Longer timers are parked in the last level
+* and re-cascaded until due.
+*
+* Insert and cancel are O(1) (intrusive slot lists indexed by handle). The driver
+* thread sleeps until the next occupied slot, an idle wheel costs no wakeups.
+*
+* Callbacks run on the driver thread one after the other. A callback may take a
+* lock only if that lock is never held across a blocking call, otherwise it
+* delays every timer of the process. cancel() waits for its own callback when it
+* is running, so a timer must not be cancelled or reset while holding a lock its
+* callback takes (debug builds assert on a cancel stuck that way).
+*/
+#ifndef RTELNET_TIMER_H
+#define RTELNET_TIMER_H
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline constexpr int RTELNET_TIMER_TICK   = 1; // ms
+inline constexpr int RTELNET_TIMER_LEVELS = 4;
+inline constexpr int RTELNET_TIMER_BITS   = 6; // 64 slots per level
+inline constexpr int RTELNET_TIMER_STUCK  = 10; // s a cancel() may wait on its callback in debug builds
+
+namespace rtnt {
+
+  class timerWheel {
+  public:
+    using timerId = uint64_t;
+    using clock = std::chrono::steady_clock;
+
+    static constexpr timerId invalidTimer = 0;
+
+    struct timerStats {
+      uint64_t scheduled = 0;
+      uint64_t cancelled = 0;
+      uint64_t fired = 0;
+      uint64_t wakeups = 0;
+    };
+
+    timerWheel() : _start(clock::now()) {
+      for (auto& level : _heads) {
+        for (auto& head : level) head = -1;
+      }
+      _driver = std::thread([this]() { run(); });
+    }
+
+    ~timerWheel() {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _cv.notify_all();
+      if (_driver.joinable()) _driver.join();
+    }
+
+    timerWheel(const timerWheel&) = delete;
+    timerWheel& operator=(const timerWheel&) = delete;
+
+    // Process wide wheel used by sessions.
+    static timerWheel& shared() {
+      static timerWheel wheel;
+      return wheel;
+    }
+
+    inline timerId schedule(std::chrono::milliseconds delay, std::function<void()> callback) {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      uint64_t expiry = toTick(clock::now() + delay, true);
+      if (expiry <= _now) expiry = _now + 1;
+
+      int32_t index = allocate();
+      node& entry = _nodes[index];
+      entry.expiry = expiry;
+      entry.callback = std::move(callback);
+      link(index);
+      ++_stats.scheduled;
+
+      // Only wake the driver if this timer is due before what it sleeps on.
+      if (expiry < _wakeTick) _cv.notify_one();
+
+      return idOf(index);
+    }
+
+    // True if the timer was removed before firing. Otherwise it already fired or
+    // is firing, and cancel() waits for that callback to return (unless called from it).
+    inline bool cancel(timerId id) {
+      if (id == invalidTimer) return false;
+
+      std::unique_lock<std::mutex> lock(_mutex);
+
+      int32_t index = static_cast<int32_t>(static_cast<uint32_t>(id)) - 1;
+      uint32_t generation = static_cast<uint32_t>(id >> 32);
+
+      if (index >= 0 && static_cast<size_t>(index) < _nodes.size() &&
+          _nodes[index].generation == generation && _nodes[index].level >= 0) {
+        unlink(index);
+        release(index);
+        ++_stats.cancelled;
+        return true;
+      }
+
+      if (std::this_thread::get_id() != _driver.get_id()) {
+        auto done = [this, id]() { return _firing != id; };
+#ifndef NDEBUG
+        // Still running after this long: the caller most likely holds a lock the callback waits for.
+        bool returned = _fired.wait_for(lock, std::chrono::seconds(RTELNET_TIMER_STUCK), done);
+        assert(returned && "timer cancelled while holding a lock its callback takes");
+#endif
+        _fired.wait(lock, done);
+      }
+      return false;
+    }
+
+    inline timerStats stats() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _stats;
+    }
+
+  private:
+    static constexpr int _slots = 1 << RTELNET_TIMER_BITS;
+    static constexpr uint64_t _slotMask = _slots - 1;
+    static constexpr uint64_t _range = 1ull << (RTELNET_TIMER_BITS * RTELNET_TIMER_LEVELS);
+
+    struct node {
+      uint64_t expiry = 0;
+      uint32_t generation = 1;
+      int32_t prev = -1;
+      int32_t next = -1;
+      int16_t level = -1; // -1 while free or firing
+      int16_t slot = 0;
+      std::function<void()> callback;
+    };
+
+    struct dueTimer {
+      timerId id;
+      std::function<void()> callback;
+    };
+
+    const clock::time_point _start;
+    std::thread _driver;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::condition_variable _fired;  // A callback returned, see cancel()
+    timerId _firing = invalidTimer;  // Timer whose callback is running, under _mutex
+    bool _stop = false;
+
+    uint64_t _now = 0;
+    uint64_t _wakeTick = std::numeric_limits<uint64_t>::max();
+    std::vector<node> _nodes;
+    int32_t _free = -1;
+    int32_t _heads[RTELNET_TIMER_LEVELS][_slots];
+    uint64_t _occupied[RTELNET_TIMER_LEVELS] = {};
+    timerStats _stats;
+
+    inline uint64_t toTick(clock::time_point time, bool roundUp) const {
+      auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(time - _start).count();
+      if (elapsed <= 0) return 0;
+
+      constexpr int64_t tick = static_cast<int64_t>(RTELNET_TIMER_TICK) * 1000000;
+      return static_cast<uint64_t>(roundUp ? (elapsed + tick - 1) / tick : elapsed / tick);
+    }
+
+    inline clock::time_point toTime(uint64_t tick) const {
+      return _start + std::chrono::milliseconds(tick * RTELNET_TIMER_TICK);
+    }
+
+    // Handle of a node: generation in the high half, index + 1 in the low half.
+    inline timerId idOf(int32_t index) const {
+      return (static_cast<uint64_t>(_nodes[index].generation) << 32) | static_cast<uint32_t>(index + 1);
+    }
+
+    inline int32_t allocate() {
+      if (_free >= 0) {
+        int32_t index = _free;
+        _free = _nodes[index].next;
+        return index;
+      }
+      _nodes.emplace_back();
+      return static_cast<int32_t>(_nodes.size() - 1);
+    }
+
+    inline void release(int32_t index) {
+      node& entry = _nodes[index];
+      entry.callback = nullptr;
+      entry.level = -1;
+      ++entry.generation;
+      entry.next = _free;
+      _free = index;
+    }
+
+    inline void link(int32_t index) {
+      node& entry = _nodes[index];
+
+      uint64_t delta = (entry.expiry > _now) ? entry.expiry - _now : 0;
+      if (delta >= _range) delta = _range - 1;
+
+      int level = 0;
+      while (level + 1 < RTELNET_TIMER_LEVELS && delta >= (1ull << (RTELNET_TIMER_BITS * (level + 1)))) ++level;
+
+      int slot = static_cast<int>(((_now + delta) >> (RTELNET_TIMER_BITS * level)) & _slotMask);
+
+      entry.level = static_cast<int16_t>(level);
+      entry.slot = static_cast<int16_t>(slot);
+      entry.prev = -1;
+      entry.next = _heads[level][slot];
+      if (entry.next >= 0) _nodes[entry.next].prev = index;
+      _heads[level][slot] = index;
+      _occupied[level] |= (1ull << slot);
+    }
+
+    inline void unlink(int32_t index) {
+      node& entry = _nodes[index];
+
+      if (entry.prev >= 0) _nodes[entry.prev].next = entry.next;
+      else _heads[entry.level][entry.slot] = entry.next;
+      if (entry.next >= 0) _nodes[entry.next].prev = entry.prev;
+
+      if (_heads[entry.level][entry.slot] < 0) _occupied[entry.level] &= ~(1ull << entry.slot);
+      entry.level = -1;
+    }
+
+    // First tick after _now at which a slot expires or cascades.
+    inline uint64_t nextEvent() const {
+      uint64_t best = std::numeric_limits<uint64_t>::max();
+
+      for (int level = 0; level < RTELNET_TIMER_LEVELS; ++level) {
+        uint64_t bits = _occupied[level];
+        if (bits == 0) continue;
+
+        uint64_t granularity = 1ull << (RTELNET_TIMER_BITS * level);
+        uint64_t period = granularity << RTELNET_TIMER_BITS;
+        uint64_t base = _now - (_now % period);
+
+        while (bits) {
+          int slot = __builtin_ctzll(bits);
+          bits &= bits - 1;
+
+          uint64_t tick = base + slot * granularity;
+          if (tick <= _now) tick += period;
+          if (tick < best) best = tick;
+        }
+      }
+
+      return best;
+    }
+
+    inline void takeSlot(int level, int slot, std::vector<int32_t>& out) {
+      for (int32_t index = _heads[level][slot]; index >= 0; index = _nodes[index].next) out.push_back(index);
+      _heads[level][slot] = -1;
+      _occupied[level] &= ~(1ull << slot);
+    }
+
+    // Moves _now to `target` jumping between occupied slots, collects due callbacks.
+    inline void advance(uint64_t target, std::vector<dueTimer>& due) {
+      std::vector<int32_t> batch;
+
+      while (_now < target) {
+        uint64_t next = nextEvent();
+        if (next > target) {
+          _now = target;
+          break;
+        }
+        _now = next;
+
+        // Cascade higher levels first so their timers can land in this tick.
+        for (int level = RTELNET_TIMER_LEVELS - 1; level >= 1; --level) {
+          uint64_t granularity = 1ull << (RTELNET_TIMER_BITS * level);
+          if (_now % granularity != 0) continue;
+
+          batch.clear();
+          takeSlot(level, static_cast<int>((_now >> (RTELNET_TIMER_BITS * level)) & _slotMask), batch);
+          for (int32_t index : batch) link(index);
+        }
+
+        batch.clear();
+        takeSlot(0, static_cast<int>(_now & _slotMask), batch);
+        for (int32_t index : batch) {
+          if (_nodes[index].expiry > _now) {
+            link(index);
+            continue;
+          }
+          due.push_back(dueTimer{idOf(index), std::move(_nodes[index].callback)});
+          release(index);
+          ++_stats.fired;
+        }
+      }
+    }
+
+    void run() {
+      std::vector<dueTimer> due;
+      std::unique_lock<std::mutex> lock(_mutex);
+
+      while (!_stop) {
+        advance(toTick(clock::now(), false), due);
+
+        if (!due.empty()) {
+          // _firing lets cancel() wait for this callback only, not for the whole batch.
+          for (auto& timer : due) {
+            _firing = timer.id;
+            lock.unlock();
+            timer.callback();
+            lock.lock();
+            _firing = invalidTimer;
+            _fired.notify_all();
+          }
+          due.clear();
+          continue;
+        }
+
+        _wakeTick = nextEvent();
+        if (_wakeTick == std::numeric_limits<uint64_t>::max()) _cv.wait(lock);
+        else _cv.wait_until(lock, toTime(_wakeTick));
+        _wakeTick = std::numeric_limits<uint64_t>::max();
+        ++_stats.wakeups;
+      }
+    }
+  };
+
+  // Cancels its timer when it goes out of scope, reset() re arms it in O(1).
+  // Lock order: destroy, cancel() or reset() it only without holding a lock the
+  // callback takes, since those wait for a callback already running.
+  class scopedTimer {
+  public:
+    scopedTimer(timerWheel& wheel, std::chrono::milliseconds delay, std::function<void()> callback)
+      : _wheel(wheel), _callback(std::move(callback)) {
+      _id = _wheel.schedule(delay, _callback);
+    }
+
+    ~scopedTimer() { _wheel.cancel(_id); }
+
+    scopedTimer(const scopedTimer&) = delete;
+    scopedTimer& operator=(const scopedTimer&) = delete;
+
+    inline void reset(std::chrono::milliseconds delay) {
+      _wheel.cancel(_id);
+      _id = _wheel.schedule(delay, _callback);
+    }
+
+    inline void cancel() {
+      _wheel.cancel(_id);
+      _id = timerWheel::invalidTimer;
+    }
+
+  private:
+    timerWheel& _wheel;
+    std::function<void()> _callback;
+    timerWheel::timerId _id = timerWheel::invalidTimer;
+  };
+
+}
+#endif // RTELNET_TIMER_H
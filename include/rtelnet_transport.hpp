@@ -0,0 +1,173 @@
+/*
+* In process transport for sessions, no socket involved.
+*
+* memoryTransport implements streamTransport over two byte buffers. The caller
+* plays the device: deliver() queues bytes for the session to read, _onWrite sees
+* everything the session writes and may deliver() a reply right away. Telnet
+* parsing, negotiation, login, Read(), Expect() and Execute() then run exactly as
+* over TCP, without a network peer and without a system call on the data path,
+* which is what the microbenchmarks and the fuzz harness need.
+*
+*   auto device = std::make_shared<rtnt::memoryTransport>();
+*   device->_onConnect = [](rtnt::memoryTransport& self) { self.deliver("login: "); };
+*   device->_onWrite = [](rtnt::memoryTransport& self, std::string_view written) { ... };
+*   Session._stream = device;
+*/
+#ifndef RTELNET_TRANSPORT_H
+#define RTELNET_TRANSPORT_H
+
+#include "rtelnet.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rtnt {
+
+  class memoryTransport : public streamTransport {
+  public:
+    // Called on every connect(), typically to deliver the option requests and the login prompt.
+    std::function<void(memoryTransport&)> _onConnect;
+
+    // Called with each write of the session, from the thread that wrote.
+    std::function<void(memoryTransport&, std::string_view)> _onWrite;
+
+    // Keep what the session wrote for written(), off for long benchmarks.
+    bool _recordWrites = true;
+
+    /*        ---          Device side         ---         */
+
+    inline void deliver(std::string_view bytes) {
+      if (bytes.empty()) return;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_offset > 0 && _offset >= _inbound.size() / 2) {
+          _inbound.erase(0, _offset);
+          _offset = 0;
+        }
+        _inbound.append(bytes);
+      }
+      _cv.notify_all();
+    }
+
+    // The session reads CONNECTION_CLOSED_R once everything delivered before was read.
+    inline void hangUp() {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _hungUp = true;
+      }
+      _cv.notify_all();
+    }
+
+    // Waits until the session has read everything delivered so far.
+    inline bool waitDrained(int timeoutMs) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      return _cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() {
+        return _offset == _inbound.size() || _interrupted;
+      });
+    }
+
+    inline std::string written() const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _written;
+    }
+
+    inline std::string takeWritten() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::string taken;
+      taken.swap(_written);
+      return taken;
+    }
+
+    inline uint64_t bytesRead() const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _bytesRead;
+    }
+
+    /*        ---         Session side         ---         */
+
+    inline unsigned int connect(const std::string&, int) override {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _inbound.clear();
+        _offset = 0;
+        _written.clear();
+        _hungUp = false;
+        _interrupted = false;
+        _open = true;
+      }
+      if (_onConnect) _onConnect(*this);
+      return RTELNET_SUCCESS;
+    }
+
+    inline unsigned int read(std::vector<unsigned char>& buffer, size_t size, int waitMs) override {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait_for(lock, std::chrono::milliseconds(waitMs), [this]() {
+        return _offset < _inbound.size() || _hungUp || _interrupted;
+      });
+
+      if (_interrupted || !_open) return Errors::CONNECTION_CLOSED_R;
+
+      size_t available = _inbound.size() - _offset;
+      if (available == 0) {
+        buffer.clear();
+        return _hungUp ? Errors::CONNECTION_CLOSED_R : RTELNET_SUCCESS;
+      }
+
+      size_t taken = std::min(size, available);
+      const unsigned char* first = reinterpret_cast<const unsigned char*>(_inbound.data()) + _offset;
+      buffer.assign(first, first + taken);
+      _offset += taken;
+      _bytesRead += taken;
+
+      if (_offset == _inbound.size()) {
+        lock.unlock();
+        _cv.notify_all(); // waitDrained()
+      }
+      return RTELNET_SUCCESS;
+    }
+
+    inline unsigned int write(const unsigned char* data, size_t size) override {
+      std::string_view bytes(reinterpret_cast<const char*>(data), size);
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_open || _interrupted) return Errors::FAILED_SEND;
+        if (_recordWrites) _written.append(bytes);
+      }
+      if (_onWrite) _onWrite(*this, bytes);
+      return RTELNET_SUCCESS;
+    }
+
+    inline void interrupt() override {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _interrupted = true;
+      }
+      _cv.notify_all();
+    }
+
+    inline void close() override {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _open = false;
+      }
+      _cv.notify_all();
+    }
+
+  private:
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    std::string _inbound;  // Delivered, read from _offset on
+    size_t _offset = 0;
+    std::string _written;
+    uint64_t _bytesRead = 0;
+    bool _hungUp = false;
+    bool _interrupted = false;
+    bool _open = false;
+  };
+
+}
+#endif // RTELNET_TRANSPORT_H
@@ -0,0 +1,43 @@
+#include "rtelnet_gateway.hpp"
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+
+using namespace rtnt;
+
+int main(int argc, char *argv[]) {
+  if (argc > 1 && (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help")) {
+    std::cerr << "Usage: " << argv[0] << " [SOCKET_PATH] [IDLE_MS] [DEBUG] [MAX_SESSIONS] [SESSION_TTL_MS]\n";
+    return 0;
+  }
+
+  std::string path = (argc > 1) ? argv[1] : gatewaySocketPath();
+  int idle = (argc > 2) ? std::atoi(argv[2]) : RTELNET_IDLE_TIMEOUT;
+  int debug = (argc > 3) ? std::atoi(argv[3]) : RTELNET_DEBUG;
+  size_t maxSessions = (argc > 4) ? std::strtoul(argv[4], nullptr, 10) : RTELNET_GATEWAY_MAX_SESSIONS;
+  int sessionTtl = (argc > 5) ? std::atoi(argv[5]) : RTELNET_GATEWAY_SESSION_TTL;
+
+  // Blocked before any thread starts, only the main thread ever sees them.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  gatewayServer server(path, idle, debug, maxSessions, sessionTtl);
+
+  unsigned int listenStatus = server.Listen();
+  if (listenStatus != RTELNET_SUCCESS) {
+    std::cerr << "[LISTEN_ERROR]: " << readError(listenStatus) << " (" << path << ")\n";
+    return 1;
+  }
+
+  std::cerr << "[relic-telnetd]: listening on " << path << "\n";
+
+  int received = 0;
+  sigwait(&signals, &received);
+
+  std::cerr << "[relic-telnetd]: stopping, " << server.sessions() << " pooled sessions.\n";
+  server.Stop();
+  return 0;
+}
@@ -0,0 +1,180 @@
+/*
+* Session tests over a memoryTransport: behaviour that regressed once and needs a
+* device playing along, without a network peer.
+*
+* Usage: relic-telnet-session-test (exits 1 when any check failed)
+*/
+#include "rtelnet.hpp"
+#include "rtelnet_adaptive.hpp"
+#include "rtelnet_admission.hpp"
+#include "rtelnet_transport.hpp"
+#include "../bench/memory_device.hpp"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+using namespace rtnt;
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                  \
+  do {                                                                                    \
+    if (!(condition)) {                                                                   \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n";    \
+      ++failures;                                                                         \
+    }                                                                                     \
+  } while (0)
+
+// The visible answer to an AYT heartbeat must not end up in the next command's
+// output, nor widen the learned idle cutoff as late output.
+static void testAytReply() {
+  auto device = rtnt_bench::memoryDevice();
+  auto lines = device->_onWrite;
+  device->_onWrite = [lines](memoryTransport& self, std::string_view written) {
+    if (written.size() == 2 && static_cast<unsigned char>(written[0]) == TelnetCommands::IAC &&
+        static_cast<unsigned char>(written[1]) == TelnetCommands::AYT) {
+      self.deliver("\r\n[Yes]\r\n");
+      return;
+    }
+    lines(self, written);
+  };
+
+  adaptiveIdleOptions options;
+  options.minSamples = 1;
+
+  session s("memory", "user", "secret");
+  s._stream = device;
+  s._idle = 50;
+  s._idleProfiles = std::make_shared<idleProfiles>("", options);
+  s._heartbeat.idle = 20;
+  s._heartbeat.command = TelnetCommands::AYT;
+  CHECK(s.Connect() == RTELNET_SUCCESS);
+
+  std::string output;
+  for (int i = 0; i < 3; ++i) {
+    output.clear();
+    CHECK(s.Execute("show clock", output) == RTELNET_SUCCESS);
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(RTELNET_READ_WAIT + 300));
+  CHECK(s.getMetrics().heartbeatsSent > 0);
+
+  output.clear();
+  CHECK(s.Execute("show version", output) == RTELNET_SUCCESS);
+  CHECK(output.find("[Yes]") == std::string::npos);
+  CHECK(output.find("show version") != std::string::npos);
+  CHECK(s.getMetrics().lateOutputs == 0);
+  CHECK(s.isAlive());
+}
+
+// A device that greets with `banner` and the username prompt, then answers the
+// password with `afterPassword`. Telnet commands the session writes are skipped.
+static std::shared_ptr<memoryTransport> loginDevice(std::string banner, std::string afterPassword) {
+  struct dialogue {
+    std::mutex mutex;
+    int lines = 0;
+    int skip = 0;
+  };
+  auto state = std::make_shared<dialogue>();
+
+  auto device = std::make_shared<memoryTransport>();
+  device->_onConnect = [state, banner](memoryTransport& self) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->lines = 0;
+    state->skip = 0;
+    self.deliver(std::string("\xff\xfb\x01\xff\xfb\x03", 6)); // WILL ECHO, WILL SGA
+    self.deliver(banner + "Username: ");
+  };
+  device->_onWrite = [state, afterPassword](memoryTransport& self, std::string_view written) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (unsigned char c : written) {
+      if (state->skip > 0) {
+        state->skip = (state->skip == 2 && c >= 251 && c <= 254) ? 1 : 0;
+        continue;
+      }
+      if (c == 255) { state->skip = 2; continue; }
+      if (c != '\n') continue;
+
+      ++state->lines;
+      if (state->lines == 1) self.deliver("Password: ");
+      else if (state->lines == 2) self.deliver(afterPassword);
+      else self.deliver("\r\nrouter#");
+    }
+  };
+  return device;
+}
+
+// Failure messages count only after the credentials went out: a banner quoting one
+// must not fail the login, the device rejecting the password must.
+static void testLoginFailures() {
+  {
+    session s("memory", "user", "secret");
+    s._stream = loginDevice("Access denied to unauthorized users\r\n\r\n", "\r\nrouter#");
+    CHECK(s.Connect() == RTELNET_SUCCESS);
+    CHECK(s.isLoggedIn());
+  }
+  {
+    session s("memory", "user", "wrong");
+    s._stream = loginDevice("", "\r\n% Authentication failed\r\n\r\nUsername: ");
+    CHECK(s.Connect() == Errors::FAILED_LOGIN);
+    CHECK(!s.isLoggedIn());
+  }
+}
+
+// A connect failing after the TCP connect gives its admission ticket back, so the
+// next session to the host is admitted. A controller outside a shared_ptr fails
+// cleanly instead of throwing with a slot taken.
+static void testAdmissionTickets() {
+  admissionOptions limits;
+  limits.maxPerHost = 1;
+  limits.queueTimeout = 1000;
+  auto admission = std::make_shared<admissionController>(limits);
+
+  {
+    session s("memory", "user", "wrong");
+    s._admission = admission;
+    s._stream = loginDevice("", "\r\n% Authentication failed\r\n\r\nUsername: ");
+    CHECK(s.Connect() == Errors::FAILED_LOGIN);
+    CHECK(admission->stats().active == 0);
+  }
+  {
+    session s("memory", "user", "secret");
+    s._admission = admission;
+    s._stream = std::make_shared<memoryTransport>(); // Never says a word
+    CHECK(s.Connect() == Errors::NEGOTIATION_TIMEOUT);
+    CHECK(admission->stats().active == 0);
+  }
+  {
+    session s("memory", "user", "secret");
+    s._admission = admission;
+    s._stream = rtnt_bench::memoryDevice();
+    CHECK(s.Connect() == RTELNET_SUCCESS);
+    CHECK(admission->stats().active == 1);
+  }
+  CHECK(admission->stats().active == 0);
+  CHECK(admission->stats().timedOut == 0);
+
+  admissionController unowned(limits);
+  admissionTicket ticket;
+  double waited = 0;
+  CHECK(!unowned.acquire("memory", ticket, waited));
+  CHECK(unowned.stats().active == 0);
+  CHECK(unowned.stats().waiting == 0);
+}
+
+int main() {
+  testAytReply();
+  testLoginFailures();
+  testAdmissionTickets();
+
+  if (failures > 0) {
+    std::cerr << failures << " check(s) failed\n";
+    return 1;
+  }
+  std::cout << "all session checks passed\n";
+  return 0;
+}
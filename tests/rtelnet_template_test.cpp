@@ -0,0 +1,464 @@
+/*
+* Unit tests of rtelnet_template.hpp: the TextFSM semantics templates rely on.
+*
+* Value options, actions, EOF and End, the regex features a template may use, and
+* the slow paths that must give the same answer as the fast ones: a state whose
+* DFA outgrew RTELNET_TEMPLATE_DFA_STATES and lines too long for the backtracker.
+*
+* Usage: relic-telnet-template-test (exits 1 when any check failed)
+*/
+#include "rtelnet_template.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace rtnt;
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                  \
+  do {                                                                                    \
+    if (!(condition)) {                                                                   \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n";    \
+      ++failures;                                                                         \
+    }                                                                                     \
+  } while (0)
+
+// A field as text: empty, the string, the number, or a List joined with ','.
+static std::string text(const templateField& field) {
+  if (const auto* value = std::get_if<std::string>(&field)) return *value;
+  if (const auto* value = std::get_if<int64_t>(&field)) return std::to_string(*value);
+  if (const auto* value = std::get_if<double>(&field)) return std::to_string(*value);
+  if (const auto* value = std::get_if<std::vector<std::string>>(&field)) {
+    std::string joined;
+    for (const std::string& item : *value) joined += (joined.empty() ? "" : ",") + item;
+    return joined;
+  }
+  return "";
+}
+
+// Rows as "a|b|c" strings, easy to compare and to print when a case fails.
+static std::vector<std::string> rows(const templateResult& result) {
+  std::vector<std::string> out;
+  for (const auto& row : result.rows) {
+    std::string line;
+    for (size_t v = 0; v < row.size(); ++v) line += (v ? "|" : "") + text(row[v]);
+    out.push_back(line);
+  }
+  return out;
+}
+
+static textTemplate compile(const std::string& source) {
+  textTemplate compiled;
+  std::string error;
+  if (!compiled.compile(source, error)) {
+    std::cerr << "compile failed: " << error << "\n" << source << "\n";
+    ++failures;
+  }
+  return compiled;
+}
+
+static std::vector<std::string> parse(const std::string& source, const std::string& output) {
+  templateResult result;
+  compile(source).parse(output, result);
+  return rows(result);
+}
+
+using expected = std::vector<std::string>;
+
+static void filldown() {
+  const char* source =
+    "Value Filldown Chassis (\\S+)\n"
+    "Value Slot (\\d+)\n"
+    "\n"
+    "Start\n"
+    "  ^chassis ${Chassis}\n"
+    "  ^slot ${Slot} -> Record\n";
+
+  // As in TextFSM the EOF record is made of the filldown value alone (Required avoids it).
+  CHECK(parse(source, "chassis A\nslot 1\nslot 2\nchassis B\nslot 3\n") ==
+        (expected{"A|1", "A|2", "B|3", "B|"}));
+
+  // Clearall drops filldown values too, Clear does not.
+  const char* clearall =
+    "Value Filldown Chassis (\\S+)\n"
+    "Value Slot (\\d+)\n"
+    "\n"
+    "Start\n"
+    "  ^chassis ${Chassis}\n"
+    "  ^slot ${Slot} -> Record\n"
+    "  ^reset -> Clearall\n"
+    "  ^keep -> Clear\n";
+  CHECK(parse(clearall, "chassis A\nkeep\nslot 1\nreset\nslot 2\n") == (expected{"A|1", "|2"}));
+}
+
+static void fillup() {
+  const char* source =
+    "Value Port (\\S+)\n"
+    "Value Fillup Vlan (\\d+)\n"
+    "\n"
+    "Start\n"
+    "  ^port ${Port} -> Record\n"
+    "  ^vlan ${Vlan}\n";
+
+  // Filled upwards into every earlier record still lacking it, not past one that has it.
+  CHECK(parse(source, "vlan 5\nport a\nport b\nvlan 7\nport c\n") ==
+        (expected{"a|5", "b|7", "c|7"}));
+}
+
+static void required() {
+  const char* source =
+    "Value Required Name (\\S+)\n"
+    "Value Mtu (\\d+)\n"
+    "\n"
+    "Start\n"
+    "  ^name ${Name}\n"
+    "  ^mtu ${Mtu}\n"
+    "  ^! -> Record\n";
+
+  // The record without a name is dropped, and its mtu with it.
+  CHECK(parse(source, "name a\nmtu 1500\n!\nmtu 9000\n!\nname b\n!\n") ==
+        (expected{"a|1500", "b|"}));
+}
+
+static void list() {
+  const char* source =
+    "Value Name (\\S+)\n"
+    "Value List Address (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^interface ${Name}\n"
+    "  ^ ip address ${Address}\n"
+    "  ^! -> Record\n";
+
+  CHECK(parse(source, "interface a\n ip address 1\n ip address 2\n!\ninterface b\n!\n") ==
+        (expected{"a|1,2", "b|"}));
+}
+
+static void integerAndFloat() {
+  const char* source =
+    "Value Integer Count (\\S+)\n"
+    "Value Float Load (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^${Count} ${Load} -> Record\n";
+
+  templateResult result;
+  compile(source).parse("42 0.5\nmany high\n", result);
+  CHECK(result.rows.size() == 2);
+  CHECK(std::holds_alternative<int64_t>(result.rows[0][0]) && std::get<int64_t>(result.rows[0][0]) == 42);
+  CHECK(std::holds_alternative<double>(result.rows[0][1]) && std::get<double>(result.rows[0][1]) == 0.5);
+  CHECK(std::holds_alternative<std::string>(result.rows[1][0])); // Does not parse, stays text
+}
+
+static void continueAction() {
+  const char* source =
+    "Value First (\\S+)\n"
+    "Value Second (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^${First} -> Continue\n"
+    "  ^\\S+ ${Second} -> Record\n";
+
+  CHECK(parse(source, "a b\nc d\n") == (expected{"a|b", "c|d"}));
+
+  // Without Continue the first matching rule ends the line.
+  const char* next =
+    "Value First (\\S+)\n"
+    "Value Second (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^${First}\n"
+    "  ^\\S+ ${Second} -> Record\n";
+  CHECK(parse(next, "a b\n") == (expected{"a|"})); // Only the EOF record
+}
+
+static void errorAction() {
+  const char* source =
+    "Value Name (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^name ${Name} -> Record\n"
+    "  ^% Invalid -> Error \"bad command\"\n";
+
+  templateResult result;
+  bool ok = compile(source).parse("name a\n% Invalid input\nname b\n", result);
+  CHECK(!ok);
+  CHECK(result.error == "bad command");
+  CHECK(rows(result) == (expected{"a"})); // Nothing after the error, no EOF record
+
+  textTemplate compiled = compile(source);
+  templateParser parser(compiled);
+  CHECK(!parser.feed("% Invalid\n"));
+  CHECK(!parser.feed("name c\n")); // Later input is ignored
+  CHECK(!parser.finish());
+  CHECK(parser.result().rows.empty());
+}
+
+static void eofAndEnd() {
+  const char* implicit =
+    "Value Name (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^name ${Name}\n";
+  CHECK(parse(implicit, "name a\n") == (expected{"a"}));
+
+  // An EOF state replaces the implicit record.
+  const char* explicitEof =
+    "Value Name (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^name ${Name}\n"
+    "\n"
+    "EOF\n";
+  CHECK(parse(explicitEof, "name a\n").empty());
+
+  // End stops the parse: no line after it is looked at and no EOF record is made.
+  const char* end =
+    "Value Name (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^name ${Name} -> Record\n"
+    "  ^stop -> End\n";
+  CHECK(parse(end, "name a\nstop\nname b\n") == (expected{"a"}));
+
+  // The last line counts even without a newline.
+  CHECK(parse(implicit, "name z") == (expected{"z"}));
+
+  std::string error;
+  textTemplate reserved;
+  CHECK(!reserved.compile("Value Name (\\S+)\n\nStart\n  ^x\n\nEnd\n  ^y\n", error));
+}
+
+static void stateTransitions() {
+  const char* source =
+    "Value Interface (\\S+)\n"
+    "Value Description (.+)\n"
+    "\n"
+    "Start\n"
+    "  ^interface ${Interface} -> Body\n"
+    "\n"
+    "Body\n"
+    "  ^ description ${Description}\n"
+    "  ^! -> Record Start\n";
+
+  CHECK(parse(source, " description ignored\ninterface a\n description up link\n!\n") ==
+        (expected{"a|up link"}));
+}
+
+static void anchors() {
+  const char* source =
+    "Value Name (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^host ${Name}$$ -> Record\n";
+
+  // $$ is the end of line anchor (TextFSM's escaped $).
+  CHECK(parse(source, "host a\nhost b trailing\nhost c\n") == (expected{"a", "c"}));
+
+  // Rules are anchored at the start only by their ^, a line ending in \r is trimmed.
+  CHECK(parse(source, "host d\r\n") == (expected{"d"}));
+
+  const char* dollar =
+    "Value Price (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^cost \\$${Price} -> Record\n";
+  CHECK(parse(dollar, "cost $5\n") == (expected{"5"}));
+}
+
+static void lazyAndGreedy() {
+  const char* greedy =
+    "Value Head (.*)\n"
+    "Value Tail (\\d+)\n"
+    "\n"
+    "Start\n"
+    "  ^${Head}${Tail}$$ -> Record\n";
+  CHECK(parse(greedy, "abc123\n") == (expected{"abc12|3"}));
+
+  const char* lazy =
+    "Value Head (.*?)\n"
+    "Value Tail (\\d+)\n"
+    "\n"
+    "Start\n"
+    "  ^${Head}${Tail}$$ -> Record\n";
+  CHECK(parse(lazy, "abc123\n") == (expected{"abc|123"}));
+
+  const char* lazyPlus =
+    "Value Word (\\w+?)\n"
+    "\n"
+    "Start\n"
+    "  ^${Word} -> Record\n";
+  CHECK(parse(lazyPlus, "hello\n") == (expected{"h"}));
+}
+
+static void boundedRepeats() {
+  const char* source =
+    "Value Area (\\d{3})\n"
+    "Value Rest (\\d{2,4})\n"
+    "\n"
+    "Start\n"
+    "  ^${Area}-${Rest}$$ -> Record\n";
+  CHECK(parse(source, "555-12\n555-1234\n555-12345\n55-12\n") == (expected{"555|12", "555|1234"}));
+
+  const char* open =
+    "Value Digits (\\d{2,})\n"
+    "\n"
+    "Start\n"
+    "  ^x${Digits}$$ -> Record\n";
+  CHECK(parse(open, "x1\nx12\nx123456\n") == (expected{"12", "123456"}));
+
+  const char* lazyBound =
+    "Value Short (\\d{2,4}?)\n"
+    "\n"
+    "Start\n"
+    "  ^${Short} -> Record\n";
+  CHECK(parse(lazyBound, "123456\n") == (expected{"12"}));
+
+  // Not a quantifier: a literal brace.
+  const char* brace =
+    "Value Body (\\w+)\n"
+    "\n"
+    "Start\n"
+    "  ^a{${Body}} -> Record\n";
+  CHECK(parse(brace, "a{x}\n") == (expected{"x"}));
+
+  std::string error;
+  textTemplate tooLarge;
+  CHECK(!tooLarge.compile("Value X (a{1,2000})\n\nStart\n  ^${X}\n", error));
+}
+
+static void ignoreCase() {
+  const char* source =
+    "Value Name (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^(?i)interface ${Name} -> Record\n";
+  CHECK(parse(source, "INTERFACE a\nInterface b\ninterface c\n") == (expected{"a", "b", "c"}));
+
+  const char* sensitive =
+    "Value Name (\\S+)\n"
+    "\n"
+    "Start\n"
+    "  ^interface ${Name} -> Record\n";
+  CHECK(parse(sensitive, "INTERFACE a\ninterface c\n") == (expected{"c"}));
+}
+
+static void rejectedSyntax() {
+  std::string error;
+  textTemplate compiled;
+  CHECK(!compiled.compile("Value X (\\S+)\n\nStart\n  ^(?=a)${X}\n", error));
+  CHECK(!compiled.compile("Value X (\\S+)\n\nStart\n  ^(a)\\1${X}\n", error));
+  CHECK(!compiled.compile("Value X (\\S+)\n\nStart\n  ^${Y}\n", error));
+  CHECK(error.find("line 4") != std::string::npos);
+}
+
+// "The 13th character from the end is an a" needs 2^13 DFA states, past the limit.
+static void dfaOverflow() {
+  const char* source =
+    "Value Tail ([ab]{12})\n"
+    "\n"
+    "Start\n"
+    "  ^[ab]*a${Tail}$$ -> Record\n"
+    "  ^other -> Record\n";
+
+  textTemplate compiled = compile(source);
+  CHECK(!compiled.states()[compiled.startState()].matcher.complete());
+
+  std::string twelve(12, 'b');
+  templateResult result;
+  compiled.parse("ba" + twelve + "\nbb" + twelve + "\n" + "a" + twelve + "\nshort\n", result);
+  CHECK(rows(result) == (expected{twelve, twelve}));
+
+  // The same rule under the limit, for comparison.
+  const char* small =
+    "Value Tail ([ab]{2})\n"
+    "\n"
+    "Start\n"
+    "  ^[ab]*a${Tail}$$ -> Record\n";
+  textTemplate smallCompiled = compile(small);
+  CHECK(smallCompiled.states()[smallCompiled.startState()].matcher.complete());
+  smallCompiled.parse("abbb\nbbb\naab\n", result);
+  CHECK(rows(result) == (expected{"ab"}));
+}
+
+// Lines past RTELNET_TEMPLATE_BACKTRACK_BITS go to the Pike VM, which must report
+// the captures the backtracker would: leftmost, then by priority.
+static void longLines() {
+  const char* source =
+    "Value Key (\\S+)\n"
+    "Value Middle (.*?)\n"
+    "Value Number (\\d+)\n"
+    "\n"
+    "Start\n"
+    "  ^${Key} ${Middle}${Number}$$ -> Record\n";
+
+  std::string filler(RTELNET_TEMPLATE_BACKTRACK_BITS, 'x');
+  CHECK(parse(source, "key " + filler + "123\n") == (expected{"key|" + filler + "|123"}));
+  CHECK(parse(source, "key xx123\n") == (expected{"key|xx|123"}));
+
+  const char* greedy =
+    "Value Key (\\S+)\n"
+    "Value Middle (.*)\n"
+    "Value Number (\\d+)\n"
+    "\n"
+    "Start\n"
+    "  ^${Key} ${Middle}${Number}$$ -> Record\n";
+  CHECK(parse(greedy, "key " + filler + "123\n") == (expected{"key|" + filler + "12|3"}));
+  CHECK(parse(greedy, "key xx123\n") == (expected{"key|xx12|3"}));
+
+  // Alternation order decides, not length.
+  const char* alternation =
+    "Value Word (ab|abcd)\n"
+    "Value Rest (.*)\n"
+    "\n"
+    "Start\n"
+    "  ^${Word}${Rest}$$ -> Record\n";
+  CHECK(parse(alternation, "abcd" + filler + "\n") == (expected{"ab|cd" + filler}));
+  CHECK(parse(alternation, "abcd\n") == (expected{"ab|cd"}));
+}
+
+// Output fed a byte at a time parses like the whole of it.
+static void chunkedFeed() {
+  const char* source =
+    "Value Filldown Chassis (\\S+)\n"
+    "Value Slot (\\d+)\n"
+    "\n"
+    "Start\n"
+    "  ^chassis ${Chassis}\n"
+    "  ^slot ${Slot} -> Record\n";
+
+  std::string output = "chassis A\r\nslot 1\r\nslot 2\r\nchassis B\r\nslot 3";
+  textTemplate compiled = compile(source);
+  templateParser parser(compiled);
+  for (char c : output) parser.feed(std::string_view(&c, 1));
+  parser.finish();
+  CHECK(rows(parser.result()) == (expected{"A|1", "A|2", "B|3", "B|"}));
+}
+
+int main() {
+  filldown();
+  fillup();
+  required();
+  list();
+  integerAndFloat();
+  continueAction();
+  errorAction();
+  eofAndEnd();
+  stateTransitions();
+  anchors();
+  lazyAndGreedy();
+  boundedRepeats();
+  ignoreCase();
+  rejectedSyntax();
+  dfaOverflow();
+  longLines();
+  chunkedFeed();
+
+  if (failures > 0) {
+    std::cerr << failures << " check(s) failed\n";
+    return 1;
+  }
+  std::cout << "all template checks passed\n";
+  return 0;
+}